@@ -40,38 +40,153 @@ using namespace std;
 
 // Individual preference list.
 using Pref = vector<int>;
+// Number of a preference list in the table of all preference lists (see PrefTable).
+using PrefId = int32_t;
 // Placeholder for unknown preference lists.
-const Pref EmptyProf = vector<int>();
+const PrefId EmptyProf = -1;
 
-// Given a preference list p, returns the index of candidate c (i.e. 0
-// if c is first in the list, 1 if c is second in the list, and so on).
-int pos(const Pref& p, const int c) {
-    for (int i = 0; i < static_cast<int>(p.size()); ++i) {
-        if (p[i] == c) {
-            return i;
+// Given two candidates c0 < c1, returns the index of the bit describing their relative
+// order in a pair order mask. Pairs are grouped by their larger candidate, so the index
+// does not depend on the total number of candidates.
+constexpr int pair_index(const int c0, const int c1) {
+    return c1 * (c1 - 1) / 2 + c0;
+}
+
+// Table of all preference lists over up to MaxC candidates. Lists are numbered as
+// sum over candidates c of k_c * c!, where k_c is the number of candidates x < c to which
+// c is preferred. This numbering does not depend on the number of candidates C: id 0 is
+// the identity 0 > 1 > ... > C - 1, and the lists of candidates {0, ..., C - 1} are exactly
+// the ids below C! (candidates C, C + 1, ... are thought of as appended at the end).
+// Each entry holds the list itself, its inverse and its pair order mask, in which bit
+// pair_index(c0, c1) is set if and only if c0 is preferred to c1.
+struct PrefTable {
+    static const int MaxC = 10;
+    vector<array<int8_t, MaxC>> lists;
+    vector<array<int8_t, MaxC>> inverses;
+    vector<uint64_t> masks;
+    // Builds the entries of all preference lists over C candidates.
+    void build(const int C) {
+        if (C > MaxC) {
+            throw invalid_argument("At most " + to_string(MaxC) + " candidates are supported.");
+        }
+        PrefId size = 1;
+        for (int c = 2; c <= C; ++c) {
+            size *= c;
+        }
+        lists.resize(size);
+        inverses.resize(size);
+        masks.resize(size);
+        for (PrefId id = 0; id < size; ++id) {
+            array<int8_t, MaxC>& l = lists[id];
+            l[0] = 0;
+            PrefId rest = id;
+            for (int c = 1; c < MaxC; ++c) {
+                // Insert c so that it is preferred to exactly k of the candidates 0, ..., c - 1.
+                const int k = rest % (c + 1);
+                rest /= c + 1;
+                for (int i = c; i > c - k; --i) {
+                    l[i] = l[i - 1];
+                }
+                l[c - k] = c;
+            }
+            uint64_t mask = 0;
+            for (int i = 0; i < MaxC; ++i) {
+                inverses[id][l[i]] = i;
+            }
+            for (int c1 = 1; c1 < MaxC; ++c1) {
+                for (int c0 = 0; c0 < c1; ++c0) {
+                    if (inverses[id][c0] < inverses[id][c1]) {
+                        mask |= uint64_t(1) << pair_index(c0, c1);
+                    }
+                }
+            }
+            masks[id] = mask;
+        }
+    }
+    PrefId size() const {
+        return lists.size();
+    }
+    static constexpr PrefId factorial(const int n) {
+        return n <= 1 ? 1 : n * factorial(n - 1);
+    }
+    // Returns the number of the preference list with pair order mask m.
+    static PrefId id_of_mask(const uint64_t m) {
+        PrefId id = 0, weight = 1;
+        for (int c = 1; c < MaxC; ++c) {
+            weight *= c;
+            const int below = c - __builtin_popcountll((m >> pair_index(0, c)) & ((uint64_t(1) << c) - 1));
+            id += below * weight;
         }
+        return id;
     }
-    throw logic_error("Could not find candidate.");
+};
+
+// The table used by all functions below, built in main for the number of candidates in use.
+PrefTable prefs;
+
+// Returns the preference list p over C candidates as a list of candidates.
+Pref get_list(const PrefId p, const int C) {
+    return Pref(prefs.lists[p].begin(), prefs.lists[p].begin() + C);
+}
+// Returns the most preferred candidate of preference list p.
+int top(const PrefId p) {
+    return prefs.lists[p][0];
+}
+// Given a preference list p, returns the index of candidate c (i.e. 0
+// if c is first in the list, 1 if c is second in the list, and so on).
+int pos(const PrefId p, const int c) {
+    return prefs.inverses[p][c];
 }
 // Given a preference list p, returns whether candidate c0 is prefered over candidate c1.
-bool prefers(const Pref& p, const int c0, const int c1) {
-    return pos(p, c0) < pos(p, c1);
+bool prefers(const PrefId p, const int c0, const int c1) {
+    const int lo = min(c0, c1), hi = max(c0, c1);
+    return ((prefs.masks[p] >> pair_index(lo, hi)) & 1) ^ (c0 > c1);
 }
 // Given two preference lists p0 and p1, returns the number of unordered pairs of candidates
 // (c0, c1) such that c0 is prefered to c1 in p0, but c1 is prefered to c0 in p1, or vice-versa.
-int cnt_crosses(const Pref& p0, const Pref& p1, const int C) {
-    vector<int> inv_p0(C), inv_p1(C);
-    for (int i = 0; i < C; ++i) {
-        inv_p0[p0[i]] = inv_p1[p1[i]] = i;
-    }
-    int ans = 0;
-    for (int c0 = 0; c0 < C; ++c0) {
-        for (int c1 = c0 + 1; c1 < C; ++c1) {
-            ans += ((inv_p0[c0] < inv_p0[c1]) != (inv_p1[c0] < inv_p1[c1]));
+int cnt_crosses(const PrefId p0, const PrefId p1, const int) {
+    // Pairs involving candidates C, C + 1, ... are ordered the same way in both lists.
+    return __builtin_popcountll(prefs.masks[p0] ^ prefs.masks[p1]);
+}
+
+// Steinhaus-Johnson-Trotter order of all preference lists over C candidates, in which
+// consecutive lists differ by a single adjacent transposition. It starts at the identity,
+// and swaps[t] is the pair (a, b) such that a comes directly before b in ids[t], but
+// directly after b in ids[t + 1].
+struct AdjacentSwapOrder {
+    vector<PrefId> ids;
+    vector<pair<int, int>> swaps;
+    void build(const int C) {
+        vector<int> l(C), dir(C, -1);
+        iota(l.begin(), l.end(), 0);
+        uint64_t mask = prefs.masks[0];
+        ids.assign(1, 0);
+        swaps.clear();
+        while (true) {
+            // Move the largest candidate which points to a smaller neighbour.
+            int i = -1;
+            for (int k = 0; k < C; ++k) {
+                const int j = k + dir[l[k]];
+                if (j >= 0 && j < C && l[j] < l[k] && (i == -1 || l[k] > l[i])) {
+                    i = k;
+                }
+            }
+            if (i == -1) {
+                break;
+            }
+            const int x = l[i], j = i + dir[x];
+            swaps.emplace_back(l[min(i, j)], l[max(i, j)]);
+            swap(l[i], l[j]);
+            for (int y = x + 1; y < C; ++y) {
+                dir[y] = -dir[y];
+            }
+            mask ^= uint64_t(1) << pair_index(min(x, l[i]), max(x, l[i]));
+            ids.push_back(PrefTable::id_of_mask(mask));
         }
     }
-    return ans;
-}
+};
+
+AdjacentSwapOrder adjacent_order;
 
 const int INF = numeric_limits<int>::max();
 
@@ -82,15 +197,21 @@ struct Rect {
     int c0, c1;
     Rect(int _r0 = INF, int _r1 = -INF, int _c0 = INF, int _c1 = -INF):
         r0(_r0), r1(_r1), c0(_c0), c1(_c1) {}
-    Rect add(const int r, const int c) {
+    Rect add(const int r, const int c) const {
         return Rect(min(r0, r), max(r1, r), min(c0, c), max(c1, c));
     }
+    bool operator==(const Rect& other) const {
+        return r0 == other.r0 && r1 == other.r1 && c0 == other.c0 && c1 == other.c1;
+    }
+    bool operator!=(const Rect& other) const {
+        return !(*this == other);
+    }
     // Returns whether the rectangle intersects the horizontal line between rows r and r + 1.
-    bool intersects_with_horizontal(const int r) {
+    bool intersects_with_horizontal(const int r) const {
         return r0 <= r && r < r1;
     }
     // Returns whether the rectangle intersects the vertical line between columns c and c + 1.
-    bool intersects_with_vertical(const int c) {
+    bool intersects_with_vertical(const int c) const {
         return c0 <= c && c < c1;
     }
 };
@@ -110,23 +231,48 @@ bool do_intersect(const Rect& r0, const Rect& r1) {
     }
 }
 
-// Preference profile - a two-dimensional array of preference lists
-// (some of which are potentially unknown).
-using Grid = vector<vector<Pref>>;
+// Preference profile - a two-dimensional array of preference lists (some of which are
+// potentially unknown), stored contiguously in row-major order. g[r] points to row r, so
+// voters are accessed as g[r][c].
+struct Grid {
+    int N = 0, M = 0;
+    vector<PrefId> cells;
+    Grid() {}
+    Grid(const int _N, const int _M, const PrefId p = EmptyProf): N(_N), M(_M), cells(_N * _M, p) {}
+    PrefId* operator[](const int r) {
+        return cells.data() + r * M;
+    }
+    const PrefId* operator[](const int r) const {
+        return cells.data() + r * M;
+    }
+    void fill(const PrefId p) {
+        std::fill(cells.begin(), cells.end(), p);
+    }
+    // Copies the voters of row into row r.
+    void set_row(const int r, const vector<PrefId>& row) {
+        copy(row.begin(), row.end(), (*this)[r]);
+    }
+    bool operator==(const Grid& other) const {
+        return N == other.N && M == other.M && cells == other.cells;
+    }
+    bool operator<(const Grid& other) const {
+        return tie(N, M, cells) < tie(other.N, other.M, other.cells);
+    }
+};
 
-// Prints a preference profile g to stdout.
-void show(const Grid& g) {
-    const int N = g.size();
+// Prints a preference profile g over C candidates to stdout.
+void show(const Grid& g, const int C) {
+    const int N = g.N;
     assert(N > 0);
-    const int M = g[0].size();
+    const int M = g.M;
     assert(M > 0);
     for (int i = 0; i < N; ++i) {
         for (int j = 0; j < M; ++j) {
             if (g[i][j] == EmptyProf) {
                 cout << "?";
             } else {
-                for (int k = 0; k < static_cast<int>(g[i][j].size()); ++k) {
-                    cout << g[i][j][k];
+                for (const int c : get_list(g[i][j], C)) {
+                    cout << c;
                 }
             }
             cout << " ";
@@ -139,9 +285,9 @@ void show(const Grid& g) {
 // Given a preference profile g and two candidates c0 and c1, returns the
 // bounding box of all voters which prefer c0 to c1 in g.
 Rect get_preference_bounding_box(const Grid& g, const int c0, const int c1) {
-    const int N = g.size();
+    const int N = g.N;
     assert(N > 0);
-    const int M = g[0].size();
+    const int M = g.M;
     assert(M > 0);
     Rect ans;
     for (int i = 0; i < N; ++i) {
@@ -154,17 +300,100 @@ Rect get_preference_bounding_box(const Grid& g, const int c0, const int c1) {
     return ans;
 }
 
+// Bounding boxes of all ordered pairs of candidates, maintained incrementally as voters are
+// placed: box(c0, c1) is the bounding box of all voters placed so far which prefer c0 to c1.
+// Every modification is recorded in an undo log, so that the search can restore an earlier
+// state when it backtracks instead of recomputing the boxes from the whole grid.
+struct PairBoxes {
+    int C;
+    vector<Rect> boxes;
+    vector<pair<int, Rect>> undo_log;
+    PairBoxes(const int _C): C(_C), boxes(_C * _C) {}
+    const Rect& box(const int c0, const int c1) const {
+        return boxes[c0 * C + c1];
+    }
+    // Adds voter (r, c) with preferences p to the boxes. Only the pairs whose boxes grow need to
+    // be checked, so this returns false if and only if one of them now intersects its opposite box.
+    bool add(const PrefId p, const int r, const int c) {
+        const auto& l = prefs.lists[p];
+        bool ok = true;
+        for (int i = 0; i < C; ++i) {
+            for (int j = i + 1; j < C; ++j) {
+                Rect& b = boxes[l[i] * C + l[j]];
+                const Rect grown = b.add(r, c);
+                if (grown != b) {
+                    undo_log.emplace_back(l[i] * C + l[j], b);
+                    b = grown;
+                    ok = ok && !do_intersect(b, box(l[j], l[i]));
+                }
+            }
+        }
+        return ok;
+    }
+    // Grows the box of (c0, c1) to contain rectangle x. Returns false if and only if it now
+    // intersects the box of (c1, c0).
+    bool add_rect(const int c0, const int c1, const Rect& x) {
+        Rect& b = boxes[c0 * C + c1];
+        const Rect grown = b.add(x.r0, x.c0).add(x.r1, x.c1);
+        if (grown != b) {
+            undo_log.emplace_back(c0 * C + c1, b);
+            b = grown;
+        }
+        return !do_intersect(b, box(c1, c0));
+    }
+    // Returns a marker which can be passed to "rollback" to undo all later modifications.
+    size_t checkpoint() const {
+        return undo_log.size();
+    }
+    void rollback(const size_t marker) {
+        while (undo_log.size() > marker) {
+            boxes[undo_log.back().first] = undo_log.back().second;
+            undo_log.pop_back();
+        }
+    }
+    // Support for walking voter (r, c) through AdjacentSwapOrder. "begin_voter" saves the
+    // boxes without the voter and places it with preferences p, "flip" swaps the preferences of
+    // the voter from a > b to b > a and "end_voter" removes it again. Since only the boxes of
+    // (a, b) and (b, a) change, a flip takes O(1) time. Both "begin_voter" and "flip" return
+    // the change in the number of unordered pairs whose boxes intersect.
+    int conflicts(const int c0, const int c1) const {
+        return do_intersect(box(c0, c1), box(c1, c0));
+    }
+    int begin_voter(vector<Rect>& saved, const PrefId p, const int r, const int c) {
+        saved = boxes;
+        const size_t marker = checkpoint();
+        add(p, r, c);
+        undo_log.resize(marker);
+        int ans = 0;
+        for (int c0 = 0; c0 < C; ++c0) {
+            for (int c1 = c0 + 1; c1 < C; ++c1) {
+                ans += conflicts(c0, c1);
+            }
+        }
+        return ans;
+    }
+    int flip(const vector<Rect>& saved, const int a, const int b, const int r, const int c) {
+        const int before = conflicts(a, b);
+        boxes[a * C + b] = saved[a * C + b];
+        boxes[b * C + a] = saved[b * C + a].add(r, c);
+        return conflicts(a, b) - before;
+    }
+    void end_voter(const vector<Rect>& saved) {
+        boxes = saved;
+    }
+};
+
 // Given a preference profile g and a candidate c, returns the bounding
 // box of all voters for which c is their most preferred candidate.
 Rect get_dominance_box(const Grid& g, const int c) {
-    const int N = g.size();
+    const int N = g.N;
     assert(N > 0);
-    const int M = g[0].size();
+    const int M = g.M;
     assert(M > 0);
     Rect ans;
     for (int i = 0; i < N; ++i) {
         for (int j = 0; j < M; ++j) {
-            if (g[i][j][0] == c) {
+            if (top(g[i][j]) == c) {
                 ans = ans.add(i, j);
             }
         }
@@ -186,30 +415,176 @@ bool grid_valid(const Grid& g, const int C) {
     return true;
 }
 
-// Given a preference profile g, returns whether all voters have
+// Validity check which simply calls "grid_valid" on the whole profile after every placement.
+// It keeps no state of its own and serves as the reference for the incremental backends.
+struct NaiveValidator {
+    const Grid& g;
+    int C;
+    NaiveValidator(const Grid& _g, const int _C): g(_g), C(_C) {}
+    Rect box(const int c0, const int c1) const {
+        return get_preference_bounding_box(g, c0, c1);
+    }
+    bool add(const PrefId, const int, const int) {
+        return grid_valid(g, C);
+    }
+    size_t checkpoint() const {
+        return 0;
+    }
+    void rollback(const size_t) {}
+};
+
+// Bitboards of all ordered pairs of candidates: bit r * M + c of bitboard (c0, c1) is set if
+// and only if voter (r, c) has been placed and prefers c0 to c1. Grids with more than 64 voters
+// use W > 1 words per bitboard. Bounding boxes are then read off with ctz/clz (for the rows)
+// for both the rows and the columns instead of rescanning the grid.
+struct PairBitboards {
+    int N, M, C, W;
+    vector<uint64_t> bits;
+    // Mask of the first row, shifted into place for each row r (W words per row).
+    vector<uint64_t> row_masks;
+    // Voters placed so far, in order, so that their bits can be cleared when backtracking.
+    vector<pair<int, PrefId>> placed;
+    PairBitboards(const int _N, const int _M, const int _C):
+        N(_N), M(_M), C(_C), W((_N * _M + 63) / 64), bits(_C * _C * W), row_masks(_N * W) {
+        for (int r = 0; r < N; ++r) {
+            for (int c = 0; c < M; ++c) {
+                const int i = r * M + c;
+                row_masks[r * W + i / 64] |= uint64_t(1) << (i % 64);
+            }
+        }
+    }
+    const uint64_t* bitboard(const int c0, const int c1) const {
+        return &bits[(c0 * C + c1) * W];
+    }
+    Rect box(const int c0, const int c1) const {
+        return bounding_box(bitboard(c0, c1));
+    }
+    // Computes the first and last rows containing voters of bitboard b. Returns false if b is empty.
+    bool row_range(const uint64_t* b, int& r0, int& r1) const {
+        int first = -1, last = -1;
+        for (int w = 0; w < W; ++w) {
+            if (b[w] != 0) {
+                if (first == -1) {
+                    first = w * 64 + __builtin_ctzll(b[w]);
+                }
+                last = w * 64 + 63 - __builtin_clzll(b[w]);
+            }
+        }
+        r0 = first / M;
+        r1 = last / M;
+        return first != -1;
+    }
+    // Bounding box of the voters in bitboard b (same as "get_preference_bounding_box").
+    Rect bounding_box(const uint64_t* b) const {
+        int r0, r1;
+        if (!row_range(b, r0, r1)) {
+            return Rect();
+        }
+        // First and last columns over the rows r0..r1, read off each word of each row with
+        // ctz/clz (a row may span several words when M > 64).
+        int c0 = M, c1 = -1;
+        for (int r = r0; r <= r1; ++r) {
+            for (int w = r * M / 64; w <= ((r + 1) * M - 1) / 64; ++w) {
+                const uint64_t x = b[w] & row_masks[r * W + w];
+                if (x != 0) {
+                    c0 = min(c0, w * 64 + __builtin_ctzll(x) - r * M);
+                    c1 = max(c1, w * 64 + 63 - __builtin_clzll(x) - r * M);
+                }
+            }
+        }
+        return Rect(r0, r1, c0, c1);
+    }
+    // Same as "do_intersect" on the bounding boxes of b0 and b1, but only looks at the
+    // columns if the rows already overlap.
+    bool do_intersect(const uint64_t* b0, const uint64_t* b1) const {
+        int r00, r01, r10, r11;
+        if (!row_range(b0, r00, r01) || !row_range(b1, r10, r11) || r00 > r11 || r10 > r01) {
+            return false;
+        }
+        return ::do_intersect(bounding_box(b0), bounding_box(b1));
+    }
+    // Same as "grid_valid" on the voters placed so far.
+    bool valid() const {
+        for (int c0 = 0; c0 < C; ++c0) {
+            for (int c1 = c0 + 1; c1 < C; ++c1) {
+                if (do_intersect(bitboard(c0, c1), bitboard(c1, c0))) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    void set(const PrefId p, const int r, const int c, const bool value) {
+        const auto& l = prefs.lists[p];
+        const int i = r * M + c;
+        const uint64_t bit = uint64_t(1) << (i % 64);
+        for (int x = 0; x < C; ++x) {
+            for (int y = x + 1; y < C; ++y) {
+                uint64_t& word = bits[(l[x] * C + l[y]) * W + i / 64];
+                word = value ? word | bit : word & ~bit;
+            }
+        }
+    }
+    bool add(const PrefId p, const int r, const int c) {
+        set(p, r, c, true);
+        placed.emplace_back(r * M + c, p);
+        return valid();
+    }
+    size_t checkpoint() const {
+        return placed.size();
+    }
+    void rollback(const size_t marker) {
+        while (placed.size() > marker) {
+            set(placed.back().second, placed.back().first / M, placed.back().first % M, false);
+            placed.pop_back();
+        }
+    }
+};
+
+// Given a preference profile g, computes the dominance boxes (as computed by
+// "get_dominance_box") of all C candidates into ans.
+void get_dominance_boxes(const Grid& g, const int C, vector<Rect>& ans) {
+    ans.assign(C, Rect());
+    for (int i = 0; i < g.N; ++i) {
+        for (int j = 0; j < g.M; ++j) {
+            ans[top(g[i][j])] = ans[top(g[i][j])].add(i, j);
+        }
+    }
+}
+
+vector<Rect> get_dominance_boxes(const Grid& g, const int C) {
+    vector<Rect> ans;
+    get_dominance_boxes(g, C, ans);
+    return ans;
+}
+
+// The following predicates only look at the dominance boxes of a profile, so they are also
+// given in terms of the boxes of an N x M profile for the engines which do not build every
+// profile explicitly.
+
+// Given the dominance boxes of a preference profile, returns whether all voters have
 // the same most preferred candidate.
-bool is_monodominated(const Grid& g) {
-    const int N = g.size();
-    assert(N > 0);
-    const int M = g[0].size();
-    assert(M > 0);
+bool is_monodominated(const vector<Rect>& dominance, const int N, const int M) {
     // It is enough to check whether all voters' most preferred candidate is 0
     // since we assumed that voter (0, 0) prefers candidates in order 0 > ... > C - 1.
-    Rect r = get_dominance_box(g, 0);
+    const Rect& r = dominance[0];
     return r.r0 == 0 && r.c0 == 0 &&
            r.r1 == N - 1 && r.c1 == M - 1;
 }
 
-// Given a preference profile g, returns whether the dominance box (as computed by a
-// call to "get_dominance_box") of some candidate does NOT touch the four sides of the grid.
-bool has_isolated(const Grid& g, const int C) {
-    const int N = g.size();
+bool is_monodominated(const Grid& g) {
+    const int N = g.N;
     assert(N > 0);
-    const int M = g[0].size();
+    const int M = g.M;
     assert(M > 0);
-    for (int c = 0; c < C; ++c) {
-        Rect r = get_dominance_box(g, c);
-        if (r.r0 == INF) {  // c is not the most preferred candidate of any voter.
+    return is_monodominated(vector<Rect>(1, get_dominance_box(g, 0)), N, M);
+}
+
+// Given the dominance boxes of a preference profile, returns whether the dominance box
+// of some candidate does NOT touch the four sides of the grid.
+bool has_isolated(const vector<Rect>& dominance, const int N, const int M) {
+    for (const Rect& r : dominance) {
+        if (r.r0 == INF) {  // Not the most preferred candidate of any voter.
             continue;
         }
         if (r.r0 > 0 && r.r1 < N - 1 && r.c0 > 0 && r.c1 < M - 1) {
@@ -219,21 +594,25 @@ bool has_isolated(const Grid& g, const int C) {
     return false;
 }
 
-// Given a preference profile g, returns whether there exists a horizontal/vertical
-// line which does not intersect the dominance box of any candidate. Note that this
-// is the same as the tiling formed by these dominance boxes admitting a split line
-// (which is the first condition for a non-trivial sliceable tiling).
-bool admits_split_line(const Grid& g, const int C) {
-    const int N = g.size();
+bool has_isolated(const Grid& g, const int C) {
+    const int N = g.N;
     assert(N > 0);
-    const int M = g[0].size();
+    const int M = g.M;
     assert(M > 0);
+    return has_isolated(get_dominance_boxes(g, C), N, M);
+}
+
+// Given the dominance boxes of a preference profile, returns whether there exists a
+// horizontal/vertical line which does not intersect the dominance box of any candidate.
+// Note that this is the same as the tiling formed by these dominance boxes admitting a
+// split line (which is the first condition for a non-trivial sliceable tiling).
+bool admits_split_line(const vector<Rect>& dominance, const int N, const int M) {
     for (int i = 0; i + 1 < N; ++i) {
         bool ok = true;
-        for (int c = 0; c < C && ok; ++c) {
-            Rect r = get_dominance_box(g, c);
+        for (const Rect& r : dominance) {
             if (r.intersects_with_horizontal(i)) {
                 ok = false;
+                break;
             }
         }
         if (ok) {
@@ -242,10 +621,10 @@ bool admits_split_line(const Grid& g, const int C) {
     }
     for (int j = 0; j + 1 < M; ++j) {
         bool ok = true;
-        for (int c = 0; c < C && ok; ++c) {
-            Rect r = get_dominance_box(g, c);
+        for (const Rect& r : dominance) {
             if (r.intersects_with_vertical(j)) {
                 ok = false;
+                break;
             }
         }
         if (ok) {
@@ -255,12 +634,20 @@ bool admits_split_line(const Grid& g, const int C) {
     return false;
 }
 
+bool admits_split_line(const Grid& g, const int C) {
+    const int N = g.N;
+    assert(N > 0);
+    const int M = g.M;
+    assert(M > 0);
+    return admits_split_line(get_dominance_boxes(g, C), N, M);
+}
+
 // Given a (potentially incomplete) preference profile g, returns whether there are two
 // voters adjacent in the grid whose preferences differ in more than one pair of candidates.
 bool grid_has_fast_cross(const Grid& g, const int C) {
-    const int N = g.size();
+    const int N = g.N;
     assert(N > 0);
-    const int M = g[0].size();
+    const int M = g.M;
     assert(M > 0);
     for (int i = 0; i + 1 < N; ++i) {
         for (int j = 0; j < M; ++j) {
@@ -279,75 +666,3136 @@ bool grid_has_fast_cross(const Grid& g, const int C) {
     return false;
 }
 
-// Backtracking search - given a (potentially incomplete) grid preference profile g and
-// the coordinates of the first voter (r, c) whose preferences have not yet been decided,
-// explores the space of complete grid single-crossing profiles which agree with g.
-// For each complete single-crossing profile we test our hypotheses.
-void backtr(Grid& g, const int C, const int r, const int c) {
-    const int N = g.size();
+// Same as "grid_has_fast_cross", but only looks at the pairs of adjacent voters involving (r, c).
+bool has_fast_cross_at(const Grid& g, const int C, const int r, const int c) {
+    const int N = g.N;
     assert(N > 0);
-    const int M = g[0].size();
+    const int M = g.M;
     assert(M > 0);
+    const int dr[] = {-1, 1, 0, 0}, dc[] = {0, 0, -1, 1};
+    for (int d = 0; d < 4; ++d) {
+        const int r1 = r + dr[d], c1 = c + dc[d];
+        if (r1 >= 0 && r1 < N && c1 >= 0 && c1 < M && g[r1][c1] != EmptyProf &&
+            cnt_crosses(g[r][c], g[r1][c1], C) > 1) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    // Experiment modifier: only test grids for which adjacent voters vary in preference
-    // by at most one pair of candidates.
-    /*if (grid_has_fast_cross(g, C)) {
+// Given a validity backend v (any of NaiveValidator, PairBoxes and PairBitboards) and an
+// empty voter (r, c), computes for every candidate x the set before[x] of candidates which
+// (r, c) must prefer to x: placing (r, c) with y > x would make the box of (y, x) intersect
+// the box of (x, y). Returns false if some pair of candidates allows neither order.
+template <typename Validator>
+bool get_forced_orders(const Validator& v, const int C, const int r, const int c, vector<uint32_t>& before) {
+    before.assign(C, 0);
+    for (int x = 0; x < C; ++x) {
+        for (int y = x + 1; y < C; ++y) {
+            const Rect xy = v.box(x, y), yx = v.box(y, x);
+            const bool x_first = !do_intersect(xy.add(r, c), yx);
+            const bool y_first = !do_intersect(yx.add(r, c), xy);
+            if (!x_first && !y_first) {
+                return false;
+            } else if (!y_first) {
+                before[y] |= 1u << x;
+            } else if (!x_first) {
+                before[x] |= 1u << y;
+            }
+        }
+    }
+    return true;
+}
+
+// Appends to out the ids of all preference lists over C candidates which put every candidate
+// x after all of before[x] (i.e. the linear extensions of the forced orders), in lexicographic
+// order of the lists. The candidates in placed are already at the front of the list, and id is
+// their contribution to the number of the list (see PrefTable).
+void get_linear_extensions(const vector<uint32_t>& before, const int C, vector<PrefId>& out,
+                           const uint32_t placed = 0, const PrefId id = 0) {
+    const uint32_t rest = ((1u << C) - 1) & ~placed;
+    if (rest == 0) {
+        out.push_back(id);
         return;
+    }
+    for (int x = 0; x < C; ++x) {
+        if ((rest >> x & 1) && (before[x] & rest) == 0) {
+            // x is preferred to all the candidates below it which have not been placed yet.
+            const int k = __builtin_popcount(rest & ((1u << x) - 1));
+            get_linear_extensions(before, C, out, placed | 1u << x, id + k * PrefTable::factorial(x));
+        }
+    }
+}
+
+// Returns the number of preference lists over C candidates which put every candidate x after
+// all of before[x], i.e. the number of lists get_linear_extensions would produce. Counts the
+// orders of the candidates not in each set of leading candidates, from the largest sets down.
+long long count_linear_extensions(const vector<uint32_t>& before, const int C) {
+    // Kept between calls, like the other buffers of the search, so that it does not allocate.
+    static thread_local vector<long long> ways;
+    const uint32_t full = (1u << C) - 1;
+    ways.resize(full + 1);
+    ways[full] = 1;
+    for (uint32_t placed = full; placed-- > 0;) {
+        const uint32_t rest = full & ~placed;
+        long long total = 0;
+        for (int x = 0; x < C; ++x) {
+            if ((rest >> x & 1) && (before[x] & rest) == 0) {
+                total += ways[placed | 1u << x];
+            }
+        }
+        ways[placed] = total;
+    }
+    return ways[0];
+}
+
+// Counters collected during a search.
+struct SearchStats {
+    // Number of voters placed (i.e. validity checks performed).
+    long long nodes = 0;
+    // Number of complete single-crossing profiles reached.
+    long long profiles = 0;
+    // Number of placements after which forward checking found a voter with no valid preferences left.
+    long long wipeouts = 0;
+    // Number of rows whose subtree was skipped because its frontier was found in the transposition table.
+    long long memo_hits = 0;
+    // Number of profiles reached which are the lex-leaders of their symmetry classes (with
+    // symmetry breaking, profiles also counts the other members of these classes).
+    long long canonical = 0;
+    // Sum of the hashes of all profiles reached. It does not depend on the order in which they are
+    // reached, so two searches which agree on it almost certainly found the same set of profiles.
+    uint64_t digest = 0;
+    SearchStats& operator+=(const SearchStats& other) {
+        nodes += other.nodes;
+        profiles += other.profiles;
+        wipeouts += other.wipeouts;
+        memo_hits += other.memo_hits;
+        canonical += other.canonical;
+        digest += other.digest;
+        return *this;
+    }
+};
+
+// One step of the splitmix64 generator, used as a hash function.
+uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Returns a hash of a complete preference profile g.
+uint64_t profile_hash(const Grid& g) {
+    uint64_t h = 0;
+    for (const PrefId p : g.cells) {
+        h = splitmix64(h + static_cast<uint64_t>(p));
+    }
+    return h;
+}
+
+// Transposition table for the row-major search. The exact pair boxes after the first r rows
+// determine all of these rows, so they are never repeated. What can still happen below the
+// node only depends on a summary of them, its frontier: for every pair of candidates, either
+// the pair is split by a vertical line, which row r - 1 shows, or every row so far orders it
+// in the same way, and it matters whether this order has already changed from one row to the
+// next. Whether the profiles below satisfy our hypotheses also depends on the dominance boxes
+// of the rows placed so far (the hypotheses only look at the dominance boxes of the complete
+// profile). Frontiers are identified by two independent 64-bit Zobrist hashes of row r - 1,
+// the pairs whose order has changed and the dominance boxes, and every entry records the
+// number of profiles in a subtree which was fully explored without finding a counterexample.
+struct TranspositionTable {
+    struct Entry {
+        uint64_t key = 0, check = 0;
+        long long profiles = -1;
+    };
+    vector<Entry> entries;
+    // Allocates 2^log_size entries (no entries disables the table).
+    void init(const int log_size) {
+        entries.assign(log_size > 0 ? size_t(1) << log_size : 0, Entry());
+    }
+    bool enabled() const {
+        return !entries.empty();
+    }
+    // Returns the number of profiles stored for the frontier (key, check), or -1 if there is none.
+    long long lookup(const uint64_t key, const uint64_t check) const {
+        const Entry& e = entries[key & (entries.size() - 1)];
+        return e.key == key && e.check == check ? e.profiles : -1;
+    }
+    void store(const uint64_t key, const uint64_t check, const long long profiles) {
+        Entry& e = entries[key & (entries.size() - 1)];
+        e.key = key;
+        e.check = check;
+        e.profiles = profiles;
+    }
+};
+
+TranspositionTable transpositions;
+
+// Zobrist key of a feature of a frontier having a given value: a pseudo-random number
+// which is fixed for every (seed, feature, value), so it does not need to be stored.
+uint64_t zobrist_key(const uint64_t seed, const uint64_t feature, const uint64_t value) {
+    return splitmix64(seed ^ splitmix64(feature * 0x100000001b3ULL + value));
+}
+
+// Returns the Zobrist hash (for a given seed) of the frontier (see TranspositionTable) of
+// a profile g after its first r rows have been placed, whose pair boxes are those of v.
+template <typename Validator>
+uint64_t frontier_hash(const Grid& g, const Validator& v, const int C, const int r, const uint64_t seed) {
+    uint64_t h = zobrist_key(seed, 0, r);
+    uint64_t feature = 1;
+    for (int c = 0; c < g.M; ++c) {
+        h ^= zobrist_key(seed, feature++, g[r - 1][c]);
+    }
+    // Pairs which are ordered one way in some rows and the other way in later rows.
+    uint64_t changed = 0;
+    for (int c1 = 1; c1 < C; ++c1) {
+        for (int c0 = 0; c0 < c1; ++c0) {
+            const Rect x = v.box(c0, c1), y = v.box(c1, c0);
+            if (x.r0 != INF && y.r0 != INF && (x.r1 < y.r0 || y.r1 < x.r0)) {
+                changed |= uint64_t(1) << pair_index(c0, c1);
+            }
+        }
+    }
+    h ^= zobrist_key(seed, feature++, changed);
+    static thread_local vector<Rect> dominance;
+    dominance.assign(C, Rect());
+    for (int i = 0; i < r; ++i) {
+        for (int j = 0; j < g.M; ++j) {
+            dominance[top(g[i][j])] = dominance[top(g[i][j])].add(i, j);
+        }
+    }
+    for (const Rect& x : dominance) {
+        h ^= zobrist_key(seed, feature++, static_cast<uint32_t>(x.r0));
+        h ^= zobrist_key(seed, feature++, static_cast<uint32_t>(x.r1));
+        h ^= zobrist_key(seed, feature++, static_cast<uint32_t>(x.c0));
+        h ^= zobrist_key(seed, feature++, static_cast<uint32_t>(x.c1));
+    }
+    return h;
+}
+
+// Given the dominance boxes of a complete single-crossing N x M profile, returns whether
+// the profile is a counterexample to the hypothesis being tested.
+bool is_counterexample(const vector<Rect>& dominance, const int N, const int M) {
+    // Hypothesis 1: All optimal k-tilings are sliceable.
+    //   N, M, C = 8, 8, 4 OK.
+    //   N, M, C = 4, 5, 5 OK.
+    //   N, M, C = 3, 6, 5 OK.
+    //   N, M, C = 3, 3, 6 OK.
+    //   N, M, C = 6, 6, 6 OK (for no "fast crosses").
+    if (!admits_split_line(dominance, N, M) && !is_monodominated(dominance, N, M)) {
+        return true;
+    }
+
+    // Hypothesis 2: All rectangles in an optimal k-tiling touch the sides of the grid.
+    // Does not hold on the following instance:
+    //   01234 02134 03214
+    //   12304 21304 32104
+    //   41230 42130 43210
+    /*if (has_isolated(dominance, N, M)) {
+        return true;
     }*/
+    return false;
+}
+
+// Bounded lock-free queue of complete profiles for any number of producer and consumer threads,
+// which carries the profiles found by the enumeration threads of the pipeline engine to its
+// checker threads (see ParallelSearch). A profile is stored as its N * M preference ids in the
+// storage of its slot, together with its position in the order of backtr (the task and the
+// index of the profile within the task). Each slot has a sequence number which tells the
+// producers and consumers whose turn it is (the bounded queue of Dmitry Vyukov): slot i is free
+// for the producer of position pos = i (mod size) when its sequence is pos, and full for the
+// consumer of position pos when its sequence is pos + 1.
+struct ProfileRing {
+    struct Slot {
+        atomic<size_t> sequence;
+        long long task, index;
+    };
+    int cells;
+    size_t mask;
+    unique_ptr<Slot[]> slots;
+    vector<PrefId> storage;
+    // Positions of the next push and pop, on separate cache lines.
+    alignas(64) atomic<size_t> tail{0};
+    alignas(64) atomic<size_t> head{0};
+    // The size is rounded up to a power of two, and to at least 2: with a single slot, the
+    // sequence of a full slot would also mark it as free for the next producer.
+    ProfileRing(const int N, const int M, const size_t size): cells(N * M) {
+        size_t n = 2;
+        while (n < size) {
+            n *= 2;
+        }
+        mask = n - 1;
+        slots.reset(new Slot[n]);
+        for (size_t i = 0; i < n; ++i) {
+            slots[i].sequence.store(i, memory_order_relaxed);
+        }
+        storage.resize(n * cells);
+    }
+    // Returns false if the queue is full.
+    bool try_push(const Grid& g, const long long task, const long long index) {
+        size_t pos = tail.load(memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[pos & mask];
+            const size_t sequence = slot.sequence.load(memory_order_acquire);
+            const ptrdiff_t diff = static_cast<ptrdiff_t>(sequence - pos);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    copy(g.cells.begin(), g.cells.end(), storage.begin() + (pos & mask) * cells);
+                    slot.task = task;
+                    slot.index = index;
+                    slot.sequence.store(pos + 1, memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load(memory_order_relaxed);
+            }
+        }
+    }
+    // Returns false if the queue is empty.
+    bool try_pop(Grid& g, long long& task, long long& index) {
+        size_t pos = head.load(memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[pos & mask];
+            const size_t sequence = slot.sequence.load(memory_order_acquire);
+            const ptrdiff_t diff = static_cast<ptrdiff_t>(sequence - (pos + 1));
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    const auto begin = storage.begin() + (pos & mask) * cells;
+                    copy(begin, begin + cells, g.cells.begin());
+                    task = slot.task;
+                    index = slot.index;
+                    slot.sequence.store(pos + mask + 1, memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head.load(memory_order_relaxed);
+            }
+        }
+    }
+};
+
+// Wait of a thread of the pipeline engine for the ProfileRing to become non-full or non-empty:
+// yields for the first few rounds, then sleeps for exponentially longer (up to about a
+// millisecond), so that idle threads do not keep their cores busy.
+struct Backoff {
+    int rounds = 0;
+    void wait() {
+        if (rounds < 16) {
+            this_thread::yield();
+        } else {
+            this_thread::sleep_for(chrono::microseconds(1 << (rounds - 16)));
+        }
+        rounds = min(rounds + 1, 26);
+    }
+    void reset() {
+        rounds = 0;
+    }
+};
+
+// State of a worker thread of ParallelSearch. The tasks of the parallel search are numbered in
+// the order in which backtr reaches them, so the counterexample which backtr would report is the
+// first one found in the lowest-numbered task which has one. Workers therefore only abandon
+// tasks numbered above the lowest task known to have a counterexample.
+struct WorkerState {
+    // Thrown by process_profile to unwind the search of a task after storing a counterexample.
+    struct Found {};
+    // Task being run.
+    long long task = 0;
+    // Lowest task known to have a counterexample (LLONG_MAX if none), shared by all workers.
+    const atomic<long long>* first_found = nullptr;
+    // Number of profiles processed by all workers, for progress reports, updated in batches.
+    atomic<long long>* profiles = nullptr;
+    Grid counterexample;
+    // With the pipeline engine, the queue to the checker threads, the index of the next profile
+    // of the task, and the number of pushes which found the queue full and the time they waited.
+    ProfileRing* ring = nullptr;
+    long long index = 0;
+    long long stalls = 0;
+    double stalled_seconds = 0;
+    bool cancelled() const {
+        return task > first_found->load(memory_order_relaxed);
+    }
+    void push(const Grid& g) {
+        if (ring->try_push(g, task, index)) {
+            ++index;
+            return;
+        }
+        ++stalls;
+        const auto start = chrono::steady_clock::now();
+        Backoff backoff;
+        while (!ring->try_push(g, task, index)) {
+            backoff.wait();
+        }
+        ++index;
+        stalled_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+};
+
+// Set on the worker threads of ParallelSearch, null otherwise.
+thread_local WorkerState* worker = nullptr;
+
+// Called by the search engines for every complete single-crossing profile g over C candidates
+// which they find. Updates the statistics and tests our hypotheses on g.
+void process_profile(const Grid& g, const int C, SearchStats& stats) {
+    // Monitor progress.
+    ++stats.profiles;
+    stats.digest += profile_hash(g);
+    if (stats.profiles % 100 == 0) {
+        // The workers of ParallelSearch count their own profiles, and only add them to the total
+        // of all workers (which they report) in batches of 100.
+        const long long processed = worker != nullptr ? worker->profiles->fetch_add(100) + 100 : stats.profiles;
+        // Written at once, so that the lines of the workers do not interleave.
+        cerr << "Processed " + to_string(processed) + " grid profiles.\n";
+    }
+    // Print grids considered.
+    //show(g, C);
 
-    // Prune profiles which can not be single-crossing early.
-    if (!grid_valid(g, C)) {
+    if (worker != nullptr && worker->ring != nullptr) {
+        // The checker threads test the hypotheses.
+        worker->push(g);
         return;
-    } else if (r == N) {
-        // Monitor progress.
-        static int cnt = 0; ++cnt;
-        if (cnt % 100 == 0) {
-            cerr << "Processed " << cnt << " grid profiles." << endl;
-        }
-        // Print grids considered.
-        //show(g);
-
-        // Hypothesis 1: All optimal k-tilings are sliceable.
-        //   N, M, C = 8, 8, 4 OK.
-        //   N, M, C = 4, 5, 5 OK.
-        //   N, M, C = 3, 6, 5 OK.
-        //   N, M, C = 3, 3, 6 OK.
-        //   N, M, C = 6, 6, 6 OK (for no "fast crosses").
-        if (!admits_split_line(g, C) && !is_monodominated(g)) {
-            show(g);
-            exit(1);
+    }
+    static thread_local vector<Rect> dominance;
+    get_dominance_boxes(g, C, dominance);
+    if (is_counterexample(dominance, g.N, g.M)) {
+        if (worker != nullptr) {
+            // ParallelSearch decides which counterexample to report once its workers are done.
+            worker->counterexample = g;
+            throw WorkerState::Found();
+        }
+        show(g, C);
+        exit(1);
+    }
+}
+
+// A symmetry of the grid, mapping profile g to the profile h with h[r][c] = g[r'][c'], where
+// (r', c') is (r, c) transposed (only for square grids) and then reflected as given.
+struct GridSymmetry {
+    bool transpose, flip_rows, flip_columns;
+    pair<int, int> source(int r, int c, const int N, const int M) const {
+        if (transpose) {
+            swap(r, c);
         }
+        return make_pair(flip_rows ? N - 1 - r : r, flip_columns ? M - 1 - c : c);
+    }
+};
 
-        // Hypothesis 2: All rectangles in an optimal k-tiling touch the sides of the grid.
-        // Does not hold on the following instance:
-        //   01234 02134 03214
-        //   12304 21304 32104
-        //   41230 42130 43210
-        /*if (has_isolated(g, C)) {
-            show(g);
-            exit(1);
-        }*/
-    } else if (c == M) {
-        backtr(g, C, r + 1, 0);
-    } else {
-        g[r][c].resize(C);
-        iota(g[r][c].begin(), g[r][c].end(), 0);
-        do {
-            backtr(g, C, r, c + 1);
-            // The first voter is assumed to always have preferences 0 > ... > C - 1.
-            if (r == 0 && c == 0) {
-                break;
+// The symmetries other than the identity used for symmetry breaking, built in main.
+vector<GridSymmetry> symmetries;
+
+vector<GridSymmetry> get_symmetries(const int N, const int M) {
+    vector<GridSymmetry> ans;
+    for (int i = 1; i < (N == M ? 8 : 4); ++i) {
+        ans.push_back(GridSymmetry{(i & 4) != 0, (i & 2) != 0, (i & 1) != 0});
+    }
+    return ans;
+}
+
+// relabel_table[l * C! + p] caches relabel(p, l, C) when there are few enough lists.
+vector<PrefId> relabel_table;
+
+// Returns preference list p over C candidates after renaming the i-th candidate of preference
+// list l to i for all i (so that l itself becomes the identity).
+PrefId relabel(const PrefId p, const PrefId l, const int C) {
+    if (!relabel_table.empty()) {
+        return relabel_table[l * prefs.size() + p];
+    }
+    const auto& order = prefs.lists[l];
+    uint64_t mask = prefs.masks[0] & ~((uint64_t(1) << (C * (C - 1) / 2)) - 1);
+    for (int b = 1; b < C; ++b) {
+        for (int a = 0; a < b; ++a) {
+            if (prefers(p, order[a], order[b])) {
+                mask |= uint64_t(1) << pair_index(a, b);
             }
-        } while (next_permutation(g[r][c].begin(), g[r][c].end()));
-        g[r][c] = EmptyProf;
+        }
     }
+    return PrefTable::id_of_mask(mask);
 }
 
-int main() {
-    const int N = 4;
-    const int M = 5;
-    const int C = 5;
-    Grid g(vector<vector<Pref>>(N, vector<Pref>(M, EmptyProf)));
-    backtr(g, C, 0, 0);
-    return 0;
+// Builds relabel_table for C candidates if it takes at most 4MB (C <= 6).
+void build_relabel_table(const int C) {
+    relabel_table.clear();
+    const size_t size = size_t(prefs.size()) * prefs.size();
+    if (size * sizeof(PrefId) > (size_t(4) << 20)) {
+        return;
+    }
+    vector<PrefId> table(size);
+    for (PrefId l = 0; l < prefs.size(); ++l) {
+        for (PrefId p = 0; p < prefs.size(); ++p) {
+            table[l * prefs.size() + p] = relabel(p, l, C);
+        }
+    }
+    relabel_table.swap(table);
+}
+
+// Stores in h the image of complete profile g under symmetry s, with the candidates renamed so
+// that voter (0, 0) prefers them in order.
+void get_image(const Grid& g, const GridSymmetry& s, const int C, Grid& h) {
+    const int N = g.N, M = g.M;
+    const pair<int, int> corner = s.source(0, 0, N, M);
+    const PrefId l = g[corner.first][corner.second];
+    if (h.N != N || h.M != M) {
+        h = Grid(N, M);
+    }
+    for (int r = 0; r < N; ++r) {
+        for (int c = 0; c < M; ++c) {
+            const pair<int, int> from = s.source(r, c, N, M);
+            h[r][c] = relabel(g[from.first][from.second], l, C);
+        }
+    }
+}
+
+// Given a (potentially incomplete) profile g, returns false if it is certain that the image of
+// every completion of g under some symmetry (see get_image) comes before it, comparing the
+// ids of the voters in row-major order. Only the voters decided in both g and the image can
+// be compared, so this needs the voter mapped to (0, 0) by the symmetry to be decided.
+bool is_lex_leader(const Grid& g, const int C) {
+    const int N = g.N, M = g.M;
+    for (const GridSymmetry& s : symmetries) {
+        const pair<int, int> corner = s.source(0, 0, N, M);
+        const PrefId l = g[corner.first][corner.second];
+        if (l == EmptyProf) {
+            continue;
+        }
+        bool decided = false;
+        for (int r = 0; r < N && !decided; ++r) {
+            for (int c = 0; c < M && !decided; ++c) {
+                const pair<int, int> from = s.source(r, c, N, M);
+                const PrefId p = g[from.first][from.second];
+                if (g[r][c] == EmptyProf || p == EmptyProf) {
+                    decided = true;
+                    continue;
+                }
+                const PrefId image = relabel(p, l, C);
+                if (image < g[r][c]) {
+                    return false;
+                }
+                decided = image > g[r][c];
+            }
+        }
+    }
+    return true;
+}
+
+// Called instead of process_profile for lex-leader profiles g when breaking symmetries. g is
+// processed as usual, and the other members of its symmetry class (on which the hypotheses
+// give the same answers) are only counted, so that profiles and digest match a search without
+// symmetry breaking.
+void process_symmetry_class(const Grid& g, const int C, SearchStats& stats) {
+    ++stats.canonical;
+    process_profile(g, C, stats);
+    // Kept between calls, like the buffers of the search, so that leaves do not allocate. The
+    // distinct images are found by sorting pointers to them.
+    static thread_local vector<Grid> images;
+    static thread_local vector<const Grid*> order;
+    images.resize(symmetries.size());
+    order.clear();
+    for (size_t i = 0; i < symmetries.size(); ++i) {
+        get_image(g, symmetries[i], C, images[i]);
+        order.push_back(&images[i]);
+    }
+    sort(order.begin(), order.end(), [](const Grid* a, const Grid* b) {
+        return *a < *b;
+    });
+    for (size_t i = 0; i < order.size(); ++i) {
+        const Grid& h = *order[i];
+        if ((i > 0 && h == *order[i - 1]) || h == g) {
+            continue;
+        }
+        ++stats.profiles;
+        stats.digest += profile_hash(h);
+    }
+}
+
+// Returns the boxes of all ordered pairs of candidates of a validity backend v. The backends
+// other than PairBoxes compute boxes on demand, so this is used to read each of them only once.
+// The copy is kept between calls (and overwritten by the next one), so that it does not allocate.
+template <typename Validator>
+const PairBoxes& copy_boxes(const Validator& v, const int C) {
+    static thread_local PairBoxes boxes(C);
+    if (boxes.C != C) {
+        boxes = PairBoxes(C);
+    }
+    for (int c0 = 0; c0 < C; ++c0) {
+        for (int c1 = 0; c1 < C; ++c1) {
+            boxes.boxes[c0 * C + c1] = v.box(c0, c1);
+        }
+    }
+    return boxes;
+}
+
+// Given a validity backend v kept in sync with g, returns the voter which has not been
+// placed yet with the fewest valid preference lists, i.e. linear extensions of the pair orders
+// forced by the boxes. Ties go to the voter with the most placed neighbours and then to the
+// one which comes first in row-major order. (The number of forced pair orders alone is almost
+// always the same for all voters of a valid partial profile.) A voter with no valid
+// preferences left is returned right away, so that the search backtracks immediately.
+template <typename Validator>
+pair<int, int> get_most_constrained_voter(const Grid& g, const Validator& v, const int C) {
+    if constexpr (!is_same<Validator, PairBoxes>::value) {
+        return get_most_constrained_voter(g, copy_boxes(v, C), C);
+    } else {
+        pair<int, int> ans(-1, -1);
+        // The best (extensions, -neighbours) so far.
+        pair<long long, int> best(LLONG_MAX, 0);
+        // Kept between calls, like the other buffers of the search, so that it does not allocate.
+        static thread_local vector<uint32_t> before;
+        for (int r = 0; r < g.N; ++r) {
+            for (int c = 0; c < g.M; ++c) {
+                if (g[r][c] != EmptyProf) {
+                    continue;
+                }
+                const long long extensions =
+                    get_forced_orders(v, C, r, c, before) ? count_linear_extensions(before, C) : 0;
+                if (extensions == 0) {
+                    return make_pair(r, c);
+                }
+                const int neighbours = (r > 0 && g[r - 1][c] != EmptyProf) + (r + 1 < g.N && g[r + 1][c] != EmptyProf) +
+                                       (c > 0 && g[r][c - 1] != EmptyProf) + (c + 1 < g.M && g[r][c + 1] != EmptyProf);
+                const pair<long long, int> key(extensions, -neighbours);
+                if (key < best) {
+                    best = key;
+                    ans = make_pair(r, c);
+                }
+            }
+        }
+        return ans;
+    }
+}
+
+// Forward checking - given a validity backend v kept in sync with g, returns false if some
+// voter which has not been placed yet can no longer be given any preferences. This happens
+// when some pair of candidates allows neither order at the voter (see get_forced_orders),
+// or when the orders forced at the voter contain a cycle.
+template <typename Validator>
+bool forward_check(const Grid& g, const Validator& v, const int C) {
+    if constexpr (!is_same<Validator, PairBoxes>::value) {
+        return forward_check(g, copy_boxes(v, C), C);
+    } else {
+        static thread_local vector<uint32_t> before;
+        for (int r = 0; r < g.N; ++r) {
+            for (int c = 0; c < g.M; ++c) {
+                if (g[r][c] != EmptyProf) {
+                    continue;
+                }
+                if (!get_forced_orders(v, C, r, c, before)) {
+                    return false;
+                }
+                // Repeatedly remove candidates none of whose predecessors are left.
+                uint32_t rest = (1u << C) - 1;
+                bool progress = true;
+                while (rest != 0 && progress) {
+                    progress = false;
+                    for (int x = 0; x < C; ++x) {
+                        if ((rest >> x & 1) && (before[x] & rest) == 0) {
+                            rest &= ~(1u << x);
+                            progress = true;
+                        }
+                    }
+                }
+                if (rest != 0) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+}
+
+// Order in which backtr walks through the preferences of a voter.
+enum class Enumeration {
+    // Increasing ids, i.e. every list is checked from scratch.
+    Lex,
+    // AdjacentSwapOrder, updating the pair boxes with one flip per list (PairBoxes only).
+    AdjacentSwaps,
+    // Only the lists consistent with the pair orders forced by the boxes (get_linear_extensions).
+    Extensions,
+};
+
+// Order in which backtr decides the voters. Voter (0, 0) always comes first.
+enum class CellOrder {
+    RowMajor,
+    // Row-major, but every other row is traversed from right to left.
+    Boustrophedon,
+    // By anti-diagonals r + c = 0, 1, ..., each from top to bottom.
+    Diagonal,
+    // Next the voter with the fewest valid preference lists (get_most_constrained_voter).
+    MostConstrained,
+};
+
+// Returns the voters of an N x M grid in the order in which they are decided. The order
+// of CellOrder::MostConstrained is only known during the search, so row-major is returned.
+vector<pair<int, int>> get_cell_order(const CellOrder order, const int N, const int M) {
+    vector<pair<int, int>> ans;
+    if (order == CellOrder::Diagonal) {
+        for (int d = 0; d < N + M - 1; ++d) {
+            for (int r = max(0, d - M + 1); r <= min(d, N - 1); ++r) {
+                ans.emplace_back(r, d - r);
+            }
+        }
+    } else {
+        for (int r = 0; r < N; ++r) {
+            for (int c = 0; c < M; ++c) {
+                const bool reversed = order == CellOrder::Boustrophedon && r % 2 == 1;
+                ans.emplace_back(r, reversed ? M - 1 - c : c);
+            }
+        }
+    }
+    return ans;
+}
+
+// Command line of grid_trial, printed when it is invalid.
+const char* const Usage =
+    "Usage: grid_trial [N M C] [--backend=naive|boxes|bitboard] [--enumeration=lex|adjacent|extensions]\n"
+    "                  [--order=rows|boustrophedon|diagonal|constrained] [--no-fast-cross]\n"
+    "                  [--forward-check] [--symmetry] [--bench-orders] [--mitm-budget=MB] [--memo=LOG_SIZE]\n"
+    "                  [--engine=backtr|separators|rows|mitm|growth|candidates|maps|tilings|\n"
+    "                            min-candidates|pinwheels|fixed|stack|parallel|pipeline]\n"
+    "                  [--checkpoint=FILE] [--checkpoint-every=SECONDS] [--threads=T] [--prefix-depth=D]\n"
+    "                  [--checkers=T] [--ring-size=SLOTS] [--shard=I --shards=K [--shard-output=FILE]]\n"
+    "                  [--base-candidates=K]\n"
+    "   or, to combine the records of the shards of a search,\n"
+    "       grid_trial --merge FILE...\n";
+
+// Search configuration, read from the command line (see Usage).
+struct Options {
+    int N = 4;
+    int M = 5;
+    int C = 5;
+    // Search engine: backtr, SeparatorSearch, RowSearch, MeetInTheMiddleSearch, GrowthSearch,
+    // CandidateSearch, TopMapSearch, TilingSearch (also with min-candidates), PinwheelSearch,
+    // FixedSearch, StackSearch or ParallelSearch (also with pipeline) (the others ignore the
+    // options specific to backtr).
+    string engine = "backtr";
+    // Validity backend used by backtr (see NaiveValidator, PairBoxes and PairBitboards).
+    string backend = "boxes";
+    Enumeration enumeration = Enumeration::Lex;
+    // Experiment modifier: only test grids for which adjacent voters vary in preference
+    // by at most one pair of candidates.
+    bool no_fast_cross = false;
+    // Prune as soon as some voter not placed yet has no valid preferences left (forward_check).
+    bool forward_check = false;
+    // Only explore the profiles which come first in their class under reflections (and
+    // transposition for square grids) followed by renaming the candidates (see is_lex_leader).
+    bool symmetry = false;
+    CellOrder cell_order = CellOrder::RowMajor;
+    // Instead of a single search, compare the cell orders on the settings from the header.
+    bool bench_orders = false;
+    // Log2 of the number of entries of the transposition table used by backtr with row-major
+    // (or boustrophedon) cell orders, or 0 to disable it.
+    int memo_log_size = 0;
+    // Checkpoint file of StackSearch (none if empty), and the time between checkpoints in seconds.
+    string checkpoint_path;
+    double checkpoint_seconds = 60;
+    // Threads of ParallelSearch (0 for one per core) and the depth at which it cuts the tree into
+    // tasks (0 to choose it automatically).
+    int threads = 0;
+    int prefix_depth = 0;
+    // Checker threads of the pipeline engine and the number of profiles its ring holds.
+    int checkers = 1;
+    int ring_size = 4096;
+    // Run only shard number shard of shards (if shards > 0) of the tasks of ParallelSearch, and
+    // write the result record of the shard to shard_output (shard-<shard>.txt if empty).
+    int shard = 0;
+    int shards = 0;
+    string shard_output;
+    // Shard records to combine (see merge_shards) instead of searching.
+    vector<string> merge_files;
+    // Memory budget for the bottom halves stored by MeetInTheMiddleSearch, in megabytes.
+    int mitm_budget_mb = 1024;
+    // Number of candidates of the profiles extended by CandidateSearch, or 0 for C - 1 (at least 1).
+    int base_candidates = 0;
+};
+
+// Builds the global tables which the search engines share for the candidates and symmetries of opt.
+void init_tables(const Options& opt) {
+    prefs.build(opt.C);
+    adjacent_order.build(opt.C);
+    symmetries = opt.symmetry ? get_symmetries(opt.N, opt.M) : vector<GridSymmetry>();
+    if (opt.symmetry) {
+        build_relabel_table(opt.C);
+    }
+}
+
+template <typename Validator>
+void backtr(Grid& g, Validator& v, SearchStats& stats, const Options& opt,
+            const vector<pair<int, int>>& cells, const int depth);
+
+// The options which determine the tree explored by backtr, as stored with the intermediate
+// results of StackSearch and ParallelSearch.
+string search_key(const Options& opt) {
+    ostringstream out;
+    out << opt.N << " " << opt.M << " " << opt.C << " " << static_cast<int>(opt.enumeration) << " "
+        << static_cast<int>(opt.cell_order) << " " << opt.no_fast_cross << " " << opt.forward_check << " "
+        << opt.symmetry;
+    return out.str();
+}
+
+// Returns options describing the search with the given key (see search_key).
+Options search_options(const string& key) {
+    Options opt;
+    int enumeration, order;
+    istringstream in(key);
+    in >> opt.N >> opt.M >> opt.C >> enumeration >> order >> opt.no_fast_cross >> opt.forward_check >> opt.symmetry;
+    if (!in) {
+        throw invalid_argument("Invalid search key: " + key);
+    }
+    opt.enumeration = static_cast<Enumeration>(enumeration);
+    opt.cell_order = static_cast<CellOrder>(order);
+    return opt;
+}
+
+// Continues the search after voter (r, c) has been placed consistently with the boxes,
+// unless one of the optional filters rejects the placement.
+template <typename Validator>
+void descend(Grid& g, Validator& v, SearchStats& stats, const Options& opt,
+             const vector<pair<int, int>>& cells, const int depth, const int r, const int c) {
+    if (opt.no_fast_cross && has_fast_cross_at(g, opt.C, r, c)) {
+        return;
+    }
+    if (opt.forward_check && !forward_check(g, v, opt.C)) {
+        ++stats.wipeouts;
+        return;
+    }
+    if (opt.symmetry && !is_lex_leader(g, opt.C)) {
+        return;
+    }
+    const int M = g.M;
+    const int r1 = (depth + 1) / M;
+    if (transpositions.enabled() && (depth + 1) % M == 0 && r1 < g.N) {
+        // A row has just been completed, so the frontier may have been explored before.
+        const uint64_t key = frontier_hash(g, v, opt.C, r1, 0);
+        const uint64_t check = frontier_hash(g, v, opt.C, r1, 1);
+        const long long profiles = transpositions.lookup(key, check);
+        if (profiles != -1) {
+            ++stats.memo_hits;
+            stats.profiles += profiles;
+            return;
+        }
+        const long long before = stats.profiles;
+        backtr(g, v, stats, opt, cells, depth + 1);
+        transpositions.store(key, check, stats.profiles - before);
+        return;
+    }
+    backtr(g, v, stats, opt, cells, depth + 1);
+}
+
+// Backtracking search - given a (potentially incomplete) grid preference profile g, a
+// validity backend v kept in sync with g (NaiveValidator, PairBoxes or PairBitboards), the
+// order cells in which voters are decided (see get_cell_order) and the number depth of
+// voters decided so far, explores the space of complete grid single-crossing profiles
+// which agree with g. For each complete single-crossing profile we test our hypotheses.
+// Profiles which can not be single-crossing are pruned as soon as the offending voter is placed.
+template <typename Validator>
+void backtr(Grid& g, Validator& v, SearchStats& stats, const Options& opt,
+            const vector<pair<int, int>>& cells, const int depth) {
+    const int C = opt.C;
+    const int N = g.N;
+    assert(N > 0);
+    const int M = g.M;
+    assert(M > 0);
+
+    // Buffers for the voter decided at each depth, kept between calls so that the search does
+    // not allocate once they have grown.
+    struct DepthBuffers {
+        vector<uint32_t> before;
+        vector<PrefId> lists;
+        vector<Rect> saved;
+    };
+    static thread_local vector<DepthBuffers> buffers;
+    // The tasks of ParallelSearch start below depth 0.
+    if (static_cast<int>(buffers.size()) < N * M) {
+        buffers.resize(N * M);
+    }
+    if (worker != nullptr && worker->cancelled()) {
+        return;
+    }
+
+    if (depth == N * M) {
+        if (opt.symmetry) {
+            process_symmetry_class(g, C, stats);
+        } else {
+            process_profile(g, C, stats);
+        }
+        return;
+    }
+
+    int r, c;
+    if (opt.cell_order == CellOrder::MostConstrained && depth > 0) {
+        tie(r, c) = get_most_constrained_voter(g, v, C);
+    } else {
+        tie(r, c) = cells[depth];
+    }
+    if (opt.enumeration == Enumeration::AdjacentSwaps && depth > 0) {
+        if constexpr (is_same<Validator, PairBoxes>::value) {
+            vector<Rect>& saved = buffers[depth].saved;
+            const vector<PrefId>& ids = adjacent_order.ids;
+            int conflicts = v.begin_voter(saved, ids[0], r, c);
+            for (size_t t = 0; t < ids.size(); ++t) {
+                if (t > 0) {
+                    conflicts += v.flip(saved, adjacent_order.swaps[t - 1].first,
+                                        adjacent_order.swaps[t - 1].second, r, c);
+                }
+                g[r][c] = ids[t];
+                ++stats.nodes;
+                if (conflicts == 0) {
+                    descend(g, v, stats, opt, cells, depth, r, c);
+                }
+            }
+            v.end_voter(saved);
+            g[r][c] = EmptyProf;
+        } else {
+            throw logic_error("Adjacent swap enumeration requires the boxes backend.");
+        }
+    } else if (opt.enumeration == Enumeration::Extensions && depth > 0) {
+        vector<uint32_t>& before = buffers[depth].before;
+        vector<PrefId>& lists = buffers[depth].lists;
+        lists.clear();
+        if (get_forced_orders(v, C, r, c, before)) {
+            get_linear_extensions(before, C, lists);
+        }
+        for (const PrefId p : lists) {
+            g[r][c] = p;
+            ++stats.nodes;
+            const size_t marker = v.checkpoint();
+            if (!v.add(p, r, c)) {
+                throw logic_error("Linear extension is not single-crossing.");
+            }
+            descend(g, v, stats, opt, cells, depth, r, c);
+            v.rollback(marker);
+        }
+        g[r][c] = EmptyProf;
+    } else {
+        for (PrefId p = 0; p < prefs.size(); ++p) {
+            g[r][c] = p;
+            // Prune profiles which can not be single-crossing early.
+            ++stats.nodes;
+            const size_t marker = v.checkpoint();
+            if (v.add(p, r, c)) {
+                descend(g, v, stats, opt, cells, depth, r, c);
+            }
+            v.rollback(marker);
+            // The first voter is assumed to always have preferences 0 > ... > C - 1 (id 0).
+            if (depth == 0) {
+                break;
+            }
+        }
+        g[r][c] = EmptyProf;
+    }
+}
+
+// Explicit-stack version of backtr for long runs, which can be stopped and resumed. It supports
+// the boxes backend with the static cell orders and lexicographic or linear extension
+// enumeration, together with the filters of descend other than the transposition table, and
+// explores the same nodes in the same order as backtr. Frame d describes the choices for the
+// voter decided at depth d; between steps, the voters of all frames below the current depth
+// are placed with their choice next - 1, and the voter of the current frame is not placed.
+// The cursors next of these frames and the statistics are therefore a complete description of
+// the state of the search, which is periodically written to a checkpoint file. When the file
+// exists at startup, the search replays the placements it describes and continues from there,
+// with the same final statistics as an uninterrupted run. The file is removed at the end.
+struct StackSearch {
+    struct Frame {
+        // Lists to try (only with linear extension enumeration; lexicographic enumeration tries
+        // every id below count).
+        vector<PrefId> lists;
+        size_t count = 0, next = 0;
+        size_t marker = 0;
+    };
+    int N, M, C;
+    const Options& opt;
+    vector<pair<int, int>> cells;
+    Grid g;
+    PairBoxes v;
+    vector<Frame> frames;
+    int depth = 0;
+    // Whether the voter of the current frame is placed, completing the profile returned by next.
+    bool at_leaf = false;
+    chrono::steady_clock::time_point last_save;
+    StackSearch(const Options& _opt):
+        N(_opt.N), M(_opt.M), C(_opt.C), opt(_opt), cells(get_cell_order(_opt.cell_order, _opt.N, _opt.M)),
+        g(_opt.N, _opt.M), v(_opt.C), frames(_opt.N * _opt.M) {
+        if (opt.backend != "boxes" || opt.enumeration == Enumeration::AdjacentSwaps ||
+            opt.cell_order == CellOrder::MostConstrained || opt.memo_log_size > 0) {
+            throw invalid_argument("The stack engine requires the boxes backend, lexicographic or linear extension "
+                                   "enumeration, a static cell order and no transposition table.");
+        }
+    }
+    // Computes the choices for the voter of depth d.
+    void open(const int d) {
+        Frame& f = frames[d];
+        f.next = 0;
+        if (d == 0) {
+            // The first voter is assumed to always have preferences 0 > ... > C - 1 (id 0).
+            f.lists.assign(1, 0);
+            f.count = 1;
+        } else if (opt.enumeration == Enumeration::Extensions) {
+            static thread_local vector<uint32_t> before;
+            f.lists.clear();
+            if (get_forced_orders(v, C, cells[d].first, cells[d].second, before)) {
+                get_linear_extensions(before, C, f.lists);
+            }
+            f.count = f.lists.size();
+        } else {
+            f.lists.clear();
+            f.count = prefs.size();
+        }
+    }
+    PrefId choice(const Frame& f, const size_t i) const {
+        return f.lists.empty() ? static_cast<PrefId>(i) : f.lists[i];
+    }
+    // Places the voter of depth d with the choice f.next of its frame and advances the cursor.
+    // Returns whether the placement passes the validity check and the filters.
+    bool place(const int d, SearchStats& stats) {
+        Frame& f = frames[d];
+        const int r = cells[d].first, c = cells[d].second;
+        const PrefId p = choice(f, f.next++);
+        f.marker = v.checkpoint();
+        g[r][c] = p;
+        if (!v.add(p, r, c)) {
+            return false;
+        }
+        if (opt.no_fast_cross && has_fast_cross_at(g, C, r, c)) {
+            return false;
+        }
+        if (opt.forward_check && !forward_check(g, v, C)) {
+            ++stats.wipeouts;
+            return false;
+        }
+        return !opt.symmetry || is_lex_leader(g, C);
+    }
+    // Removes the voter of depth d.
+    void undo(const int d) {
+        v.rollback(frames[d].marker);
+        g[cells[d].first][cells[d].second] = EmptyProf;
+    }
+    void save(const SearchStats& stats) {
+        const string tmp = opt.checkpoint_path + ".tmp";
+        {
+            ofstream out(tmp);
+            out << "grid_trial checkpoint" << endl;
+            out << search_key(opt) << endl;
+            out << stats.nodes << " " << stats.profiles << " " << stats.wipeouts << " " << stats.canonical << " "
+                << stats.digest << endl;
+            out << depth;
+            for (int d = 0; d <= depth; ++d) {
+                out << " " << frames[d].next;
+            }
+            out << endl;
+            if (!out) {
+                throw runtime_error("Could not write the checkpoint " + tmp + ".");
+            }
+        }
+        if (rename(tmp.c_str(), opt.checkpoint_path.c_str()) != 0) {
+            throw runtime_error("Could not replace the checkpoint " + opt.checkpoint_path + ".");
+        }
+        last_save = chrono::steady_clock::now();
+    }
+    // Restores the state saved by save, if there is a checkpoint. Returns whether there was one.
+    bool load(SearchStats& stats) {
+        ifstream in(opt.checkpoint_path);
+        if (!in) {
+            return false;
+        }
+        string header, key;
+        getline(in, header);
+        getline(in, key);
+        if (header != "grid_trial checkpoint" || key != search_key(opt)) {
+            throw invalid_argument("The checkpoint " + opt.checkpoint_path + " belongs to a different search.");
+        }
+        in >> stats.nodes >> stats.profiles >> stats.wipeouts >> stats.canonical >> stats.digest >> depth;
+        if (!in || depth < 0 || depth >= N * M) {
+            throw invalid_argument("The checkpoint " + opt.checkpoint_path + " has an invalid depth.");
+        }
+        vector<size_t> next(depth + 1);
+        for (size_t& x : next) {
+            in >> x;
+        }
+        if (!in) {
+            throw invalid_argument("The checkpoint " + opt.checkpoint_path + " is truncated.");
+        }
+        // Replay the placements, without counting them again.
+        SearchStats replay;
+        for (int d = 0; d <= depth; ++d) {
+            open(d);
+            // The frames below depth have placed their choice next - 1.
+            if (next[d] < (d < depth ? 1 : 0) || next[d] > frames[d].count) {
+                throw invalid_argument("The checkpoint " + opt.checkpoint_path + " has an invalid cursor at depth " +
+                                       to_string(d) + ".");
+            }
+            if (d < depth) {
+                frames[d].next = next[d] - 1;
+                if (!place(d, replay)) {
+                    throw invalid_argument("The checkpoint " + opt.checkpoint_path +
+                                           " does not describe a valid search state.");
+                }
+            }
+            frames[d].next = next[d];
+        }
+        return true;
+    }
+    // Prepares the search, resuming it from the checkpoint if there is one.
+    void start(SearchStats& stats) {
+        if (load(stats)) {
+            cerr << "Resuming from " << opt.checkpoint_path << " after " << stats.nodes << " nodes." << endl;
+        } else {
+            open(0);
+        }
+        last_save = chrono::steady_clock::now();
+    }
+    // Advances the search to the next complete profile, which is left in g until the next call,
+    // and returns true, or returns false (and removes the checkpoint) once the search is over.
+    bool next(SearchStats& stats) {
+        if (at_leaf) {
+            at_leaf = false;
+            undo(depth);
+        }
+        const bool checkpoints = !opt.checkpoint_path.empty();
+        while (true) {
+            if (checkpoints && (stats.nodes & 0xffff) == 0 &&
+                chrono::duration<double>(chrono::steady_clock::now() - last_save).count() >= opt.checkpoint_seconds) {
+                save(stats);
+            }
+            Frame& f = frames[depth];
+            if (f.next == f.count) {
+                if (depth == 0) {
+                    if (checkpoints) {
+                        remove(opt.checkpoint_path.c_str());
+                    }
+                    return false;
+                }
+                undo(--depth);
+                continue;
+            }
+            ++stats.nodes;
+            if (!place(depth, stats)) {
+                undo(depth);
+            } else if (depth + 1 == N * M) {
+                at_leaf = true;
+                return true;
+            } else {
+                open(++depth);
+            }
+        }
+    }
+    void search(SearchStats& stats) {
+        start(stats);
+        while (next(stats)) {
+            if (opt.symmetry) {
+                process_symmetry_class(g, C, stats);
+            } else {
+                process_profile(g, C, stats);
+            }
+        }
+    }
+};
+
+// Lazy enumeration of the complete single-crossing profiles explored by backtr, for the
+// dimensions, filters (no_fast_cross and forward_check), symmetry breaking, cell order and
+// enumeration given in opt (as supported by StackSearch), as an input range:
+//   for (const Grid& g : GridProfiles(opt)) {
+//       if (...) {
+//           break;
+//       }
+//   }
+// Each profile is a view of the grid of the underlying StackSearch, valid until the iterator is
+// advanced, so consumers pay no allocation per profile. With symmetry breaking, only the
+// lex-leader of each class is produced (get_image gives the others). The profiles are neither
+// counted nor tested, which is up to the consumer, and stopping early is just leaving the loop.
+// The preference tables are global, so ranges over different numbers of candidates (or with
+// and without symmetry breaking) must not be used at the same time. The iterators are input
+// iterators, so the range also works with the algorithms of <algorithm> which only make one
+// pass, e.g. find_if(profiles.begin(), profiles.end(), ...).
+struct GridProfiles {
+    struct iterator {
+        // Result of it++, which keeps a copy of the profile the iterator pointed to (the view
+        // changes with the iterator, so this is the only operation which copies a profile).
+        struct Postfix {
+            Grid value;
+            const Grid& operator*() const {
+                return value;
+            }
+        };
+        using iterator_category = input_iterator_tag;
+        using value_type = Grid;
+        using difference_type = ptrdiff_t;
+        using pointer = const Grid*;
+        using reference = const Grid&;
+        // Null for the end iterator.
+        GridProfiles* range = nullptr;
+        bool at_end() const {
+            return range == nullptr || range->done;
+        }
+        const Grid& operator*() const {
+            return range->search.g;
+        }
+        const Grid* operator->() const {
+            return &range->search.g;
+        }
+        iterator& operator++() {
+            range->advance();
+            return *this;
+        }
+        Postfix operator++(int) {
+            Postfix old{**this};
+            range->advance();
+            return old;
+        }
+        // All iterators of a range share its position, so they only differ by being at the end.
+        bool operator==(const iterator& other) const {
+            return at_end() == other.at_end() && (at_end() || range == other.range);
+        }
+        bool operator!=(const iterator& other) const {
+            return !(*this == other);
+        }
+    };
+    Options opt;
+    StackSearch search;
+    // Statistics of the search so far (nodes, and wipeouts with forward checking).
+    SearchStats stats;
+    bool started = false, done = false;
+    GridProfiles(const Options& _opt): opt(_opt), search(opt) {
+        init_tables(opt);
+    }
+    // The search refers to opt.
+    GridProfiles(const GridProfiles&) = delete;
+    GridProfiles& operator=(const GridProfiles&) = delete;
+    void advance() {
+        done = !search.next(stats);
+    }
+    // Starts the search; a range can only be iterated once.
+    iterator begin() {
+        if (started) {
+            throw logic_error("GridProfiles can only be iterated once.");
+        }
+        started = true;
+        search.start(stats);
+        advance();
+        return iterator{this};
+    }
+    iterator end() const {
+        return iterator();
+    }
+};
+
+// Result record of one shard of ParallelSearch, which owns the tasks t with t % shards = shard.
+// Every shard cuts the tree in the same way, so it knows the number of tasks of the whole search
+// and the sum of their digests (see ParallelSearch::task_hash), and merge_shards can check with
+// them that the shards completed every task exactly once.
+struct ShardRecord {
+    string key;
+    int shard = 0, shards = 0, prefix_depth = 0;
+    long long num_tasks = 0;
+    uint64_t tasks_digest = 0;
+    // Number of tasks completed by the shard and the sum of their digests.
+    long long completed = 0;
+    uint64_t completed_digest = 0;
+    // The first task of the shard which it did not complete (num_tasks if none), and the sum of
+    // the digests of the tasks of the shard before it.
+    long long complete_below = 0;
+    uint64_t complete_below_digest = 0;
+    // Statistics of the tasks of the shard (for shard 0, also of the tree above the tasks).
+    SearchStats stats;
+    double seconds = 0;
+    // The first task of the shard with a counterexample (-1 if none), and the counterexample.
+    long long counterexample_task = -1;
+    Grid counterexample;
+    void write(const string& path) const {
+        ofstream out(path);
+        out << "grid_trial shard" << endl;
+        out << key << endl;
+        out << "shard " << shard << " " << shards << endl;
+        out << "tasks " << prefix_depth << " " << num_tasks << " " << tasks_digest << endl;
+        out << "completed " << completed << " " << completed_digest << endl;
+        out << "complete-below " << complete_below << " " << complete_below_digest << endl;
+        out << "stats " << stats.nodes << " " << stats.profiles << " " << stats.wipeouts << " " << stats.canonical
+            << " " << stats.digest << endl;
+        out << "seconds " << seconds << endl;
+        out << "counterexample " << counterexample_task;
+        if (counterexample_task != -1) {
+            for (const PrefId p : counterexample.cells) {
+                out << " " << p;
+            }
+        }
+        out << endl;
+        if (!out) {
+            throw runtime_error("Could not write the shard record " + path + ".");
+        }
+    }
+    static void expect(istream& in, const string& label, const string& path) {
+        string x;
+        if (!(in >> x) || x != label) {
+            throw invalid_argument("Malformed shard record " + path + ": expected " + label + ".");
+        }
+    }
+    static ShardRecord read(const string& path) {
+        ifstream in(path);
+        if (!in) {
+            throw invalid_argument("Could not read the shard record " + path + ".");
+        }
+        ShardRecord record;
+        string header;
+        getline(in, header);
+        getline(in, record.key);
+        if (header != "grid_trial shard") {
+            throw invalid_argument(path + " is not a shard record.");
+        }
+        expect(in, "shard", path);
+        in >> record.shard >> record.shards;
+        expect(in, "tasks", path);
+        in >> record.prefix_depth >> record.num_tasks >> record.tasks_digest;
+        expect(in, "completed", path);
+        in >> record.completed >> record.completed_digest;
+        expect(in, "complete-below", path);
+        in >> record.complete_below >> record.complete_below_digest;
+        expect(in, "stats", path);
+        SearchStats& stats = record.stats;
+        in >> stats.nodes >> stats.profiles >> stats.wipeouts >> stats.canonical >> stats.digest;
+        expect(in, "seconds", path);
+        in >> record.seconds;
+        expect(in, "counterexample", path);
+        in >> record.counterexample_task;
+        if (record.counterexample_task != -1) {
+            int N, M;
+            istringstream(record.key) >> N >> M;
+            record.counterexample = Grid(N, M);
+            for (PrefId& p : record.counterexample.cells) {
+                in >> p;
+            }
+        }
+        if (!in) {
+            throw invalid_argument("The shard record " + path + " is truncated.");
+        }
+        return record;
+    }
+};
+
+// Parallel version of backtr. The search tree is cut at depth prefix_depth into tasks, each being
+// the placements of the voters decided above that depth, and the tasks are run on a pool of
+// threads with work stealing: worker w starts with the tasks w, w + T, ... of the T workers and
+// takes them in increasing order, and once it runs out, it steals the last task of another
+// worker. Each worker has its own grid, backend and statistics, which are added up at the end,
+// so that the statistics are those of backtr. On a counterexample the workers stop the tasks
+// after it (see WorkerState) and the search reports the counterexample backtr would report.
+// With opt.shards > 0, the search only runs the tasks of shard opt.shard and writes its
+// ShardRecord. The pipeline engine runs the same search, but the workers only enumerate the
+// profiles and hand them to opt.checkers threads through a ProfileRing, which test the
+// hypotheses. Workers wait while the ring is full, and the time spent waiting on either side of
+// the ring shows which of the two stages is the bottleneck.
+struct ParallelSearch {
+    struct Placement {
+        int r, c;
+        PrefId p;
+    };
+    struct TaskQueue {
+        mutex m;
+        deque<long long> tasks;
+    };
+    struct WorkerResult {
+        SearchStats stats;
+        // Number of tasks completed and the sum of their digests.
+        long long completed = 0;
+        uint64_t completed_digest = 0;
+        // With the pipeline engine, the number of profiles pushed to the ring, and the number of
+        // pushes which found it full and the time they waited.
+        long long pushed = 0;
+        long long stalls = 0;
+        double stalled_seconds = 0;
+    };
+    struct CheckerResult {
+        // Number of profiles checked, and the time spent waiting for profiles.
+        long long checked = 0;
+        double idle_seconds = 0;
+    };
+    int N, M, C;
+    const Options& opt;
+    vector<pair<int, int>> cells;
+    int threads;
+    int shard, shards;
+    int prefix_depth = 0;
+    // The placements of task t are tasks[t * prefix_depth], ..., tasks[(t + 1) * prefix_depth - 1].
+    vector<Placement> tasks;
+    long long num_tasks = 0;
+    vector<TaskQueue> queues;
+    // Whether each task has been completed (each is only written by the worker running it).
+    vector<char> done;
+    atomic<long long> first_found{LLONG_MAX};
+    atomic<long long> profiles{0};
+    mutex found_mutex;
+    // The first counterexample found, at index found_index of task first_found.
+    Grid found;
+    long long found_index = 0;
+    // Only with the pipeline engine.
+    unique_ptr<ProfileRing> ring;
+    atomic<bool> enumerated{false};
+    ParallelSearch(const Options& _opt):
+        N(_opt.N), M(_opt.M), C(_opt.C), opt(_opt), cells(get_cell_order(_opt.cell_order, _opt.N, _opt.M)),
+        threads(_opt.threads > 0 ? _opt.threads : max(1, static_cast<int>(thread::hardware_concurrency()))),
+        shard(_opt.shards > 0 ? _opt.shard : 0), shards(max(_opt.shards, 1)), queues(threads) {
+        if (opt.backend != "boxes" || opt.memo_log_size > 0) {
+            throw invalid_argument("The parallel engine requires the boxes backend and no transposition table.");
+        }
+        if (shard < 0 || shard >= shards) {
+            throw invalid_argument("The shard must be between 0 and the number of shards minus one.");
+        }
+        if (opt.engine == "pipeline") {
+            if (opt.checkers <= 0 || opt.ring_size <= 0) {
+                throw invalid_argument("The pipeline needs at least one checker and one slot.");
+            }
+            ring.reset(new ProfileRing(N, M, opt.ring_size));
+        }
+    }
+    // The filters applied by descend to the placement of voter (r, c).
+    bool accept(const Grid& g, const PairBoxes& v, SearchStats& stats, const int r, const int c) const {
+        if (opt.no_fast_cross && has_fast_cross_at(g, C, r, c)) {
+            return false;
+        }
+        if (opt.forward_check && !forward_check(g, v, C)) {
+            ++stats.wipeouts;
+            return false;
+        }
+        return !opt.symmetry || is_lex_leader(g, C);
+    }
+    // Explores the tree above prefix_depth like backtr, recording the placements leading to each
+    // node at prefix_depth as a task.
+    void split(Grid& g, PairBoxes& v, SearchStats& stats, const int depth, vector<Placement>& path) {
+        if (depth == prefix_depth) {
+            tasks.insert(tasks.end(), path.begin(), path.end());
+            ++num_tasks;
+            return;
+        }
+        int r, c;
+        if (opt.cell_order == CellOrder::MostConstrained && depth > 0) {
+            tie(r, c) = get_most_constrained_voter(g, v, C);
+        } else {
+            tie(r, c) = cells[depth];
+        }
+        vector<PrefId> lists;
+        if (depth == 0) {
+            // The first voter is assumed to always have preferences 0 > ... > C - 1 (id 0).
+            lists.assign(1, 0);
+        } else if (opt.enumeration == Enumeration::AdjacentSwaps) {
+            lists = adjacent_order.ids;
+        } else if (opt.enumeration == Enumeration::Extensions) {
+            vector<uint32_t> before;
+            if (get_forced_orders(v, C, r, c, before)) {
+                get_linear_extensions(before, C, lists);
+            }
+        } else {
+            lists.resize(prefs.size());
+            iota(lists.begin(), lists.end(), 0);
+        }
+        for (const PrefId p : lists) {
+            g[r][c] = p;
+            ++stats.nodes;
+            const size_t marker = v.checkpoint();
+            if (v.add(p, r, c) && accept(g, v, stats, r, c)) {
+                path.push_back({r, c, p});
+                split(g, v, stats, depth + 1, path);
+                path.pop_back();
+            }
+            v.rollback(marker);
+        }
+        g[r][c] = EmptyProf;
+    }
+    // Cuts the tree at opt.prefix_depth, or if it is 0, at the first depth with at least 64 tasks
+    // per thread (256 per shard when sharding, since the cut must not depend on the machine), and
+    // returns the statistics of the tree above the cut.
+    SearchStats make_tasks() {
+        const long long target = opt.shards > 0 ? 256LL * opt.shards : 64LL * threads;
+        for (int depth = opt.prefix_depth > 0 ? min(opt.prefix_depth, N * M) : 1;; ++depth) {
+            prefix_depth = depth;
+            tasks.clear();
+            num_tasks = 0;
+            Grid g(N, M);
+            PairBoxes v(C);
+            SearchStats above;
+            vector<Placement> path;
+            split(g, v, above, 0, path);
+            if (opt.prefix_depth > 0 || num_tasks >= target || depth == N * M) {
+                return above;
+            }
+        }
+    }
+    // Digest of the placements of task t.
+    uint64_t task_hash(const long long t) const {
+        uint64_t h = 0;
+        for (int d = 0; d < prefix_depth; ++d) {
+            const Placement& x = tasks[t * prefix_depth + d];
+            h = splitmix64(h + static_cast<uint64_t>(x.r * M + x.c) * prefs.size() + x.p);
+        }
+        return h;
+    }
+    // Takes the next task of worker w, stealing one if it has none left. Returns false when there
+    // are no tasks left.
+    bool next_task(const int w, long long& t) {
+        for (int i = 0; i < threads; ++i) {
+            TaskQueue& q = queues[(w + i) % threads];
+            lock_guard<mutex> lock(q.m);
+            if (!q.tasks.empty()) {
+                if (i == 0) {
+                    t = q.tasks.front();
+                    q.tasks.pop_front();
+                } else {
+                    t = q.tasks.back();
+                    q.tasks.pop_back();
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+    // Records counterexample g, found at the given index of task t, if it comes before the one
+    // recorded so far.
+    void report(const Grid& g, const long long t, const long long index) {
+        lock_guard<mutex> lock(found_mutex);
+        if (make_pair(t, index) < make_pair(first_found.load(), found_index)) {
+            found = g;
+            found_index = index;
+            first_found = t;
+        }
+    }
+    void work(const int w, WorkerResult& result) {
+        WorkerState state;
+        state.first_found = &first_found;
+        state.profiles = &profiles;
+        state.ring = ring.get();
+        worker = &state;
+        Grid g(N, M);
+        PairBoxes v(C);
+        long long t;
+        while (next_task(w, t)) {
+            if (t > first_found.load()) {
+                continue;
+            }
+            state.task = t;
+            result.pushed += state.index;
+            state.index = 0;
+            for (int d = 0; d < prefix_depth; ++d) {
+                const Placement& x = tasks[t * prefix_depth + d];
+                g[x.r][x.c] = x.p;
+                v.add(x.p, x.r, x.c);
+            }
+            try {
+                backtr(g, v, result.stats, opt, cells, prefix_depth);
+                v.rollback(0);
+                // Otherwise backtr may have returned early.
+                if (!state.cancelled()) {
+                    ++result.completed;
+                    result.completed_digest += task_hash(t);
+                    done[t] = 1;
+                }
+            } catch (const WorkerState::Found&) {
+                report(state.counterexample, t, 0);
+                // The search was left in the middle of a voter.
+                v = PairBoxes(C);
+            }
+            g.fill(EmptyProf);
+        }
+        result.pushed += state.index;
+        result.stalls = state.stalls;
+        result.stalled_seconds = state.stalled_seconds;
+        worker = nullptr;
+    }
+    // Checker thread of the pipeline engine, which runs until the workers are done and the ring
+    // is empty.
+    void check(CheckerResult& result) {
+        Grid g(N, M);
+        vector<Rect> dominance;
+        long long t, index;
+        Backoff backoff;
+        while (true) {
+            // Read before trying the ring, so that all profiles have been pushed if it is set.
+            const bool done = enumerated.load(memory_order_acquire);
+            if (ring->try_pop(g, t, index)) {
+                backoff.reset();
+                ++result.checked;
+                get_dominance_boxes(g, C, dominance);
+                if (is_counterexample(dominance, N, M)) {
+                    report(g, t, index);
+                }
+                continue;
+            }
+            if (done) {
+                break;
+            }
+            const auto start = chrono::steady_clock::now();
+            backoff.wait();
+            result.idle_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+    }
+    void search(SearchStats& stats) {
+        const auto start = chrono::steady_clock::now();
+        const SearchStats above = make_tasks();
+        // The tree above the cut is counted by shard 0 only.
+        if (shard == 0) {
+            stats += above;
+        }
+        cerr << "Split the search at depth " << prefix_depth << " into " << num_tasks << " tasks for " << threads
+             << " threads";
+        if (opt.shards > 0) {
+            cerr << ", running shard " << shard << " of " << shards;
+        }
+        cerr << "." << endl;
+        done.assign(num_tasks, 0);
+        for (long long t = shard, i = 0; t < num_tasks; t += shards, ++i) {
+            queues[i % threads].tasks.push_back(t);
+        }
+        vector<WorkerResult> results(threads);
+        vector<CheckerResult> checker_results(ring ? opt.checkers : 0);
+        vector<thread> pool, checkers;
+        for (CheckerResult& x : checker_results) {
+            checkers.emplace_back(&ParallelSearch::check, this, ref(x));
+        }
+        for (int w = 0; w < threads; ++w) {
+            pool.emplace_back(&ParallelSearch::work, this, w, ref(results[w]));
+        }
+        for (thread& x : pool) {
+            x.join();
+        }
+        const double enumeration_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        enumerated.store(true, memory_order_release);
+        for (thread& x : checkers) {
+            x.join();
+        }
+        ShardRecord record;
+        WorkerResult total;
+        for (const WorkerResult& x : results) {
+            stats += x.stats;
+            record.completed += x.completed;
+            record.completed_digest += x.completed_digest;
+            total.pushed += x.pushed;
+            total.stalls += x.stalls;
+            total.stalled_seconds += x.stalled_seconds;
+        }
+        if (ring) {
+            const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            CheckerResult checked;
+            for (const CheckerResult& x : checker_results) {
+                checked.checked += x.checked;
+                checked.idle_seconds += x.idle_seconds;
+            }
+            cerr << "Enumeration: " << threads << " threads pushed " << total.pushed << " profiles in "
+                 << enumeration_seconds << "s (" << static_cast<long long>(total.pushed / max(enumeration_seconds, 1e-9))
+                 << " profiles/sec), " << total.stalls << " pushes waited " << total.stalled_seconds
+                 << "s in total for a full ring." << endl;
+            cerr << "Checking: " << opt.checkers << " threads checked " << checked.checked << " profiles in " << seconds
+                 << "s (" << static_cast<long long>(checked.checked / max(seconds, 1e-9)) << " profiles/sec), waiting "
+                 << checked.idle_seconds << "s in total for an empty ring." << endl;
+        }
+        if (opt.shards > 0) {
+            record.key = search_key(opt);
+            record.shard = shard;
+            record.shards = shards;
+            record.prefix_depth = prefix_depth;
+            record.num_tasks = num_tasks;
+            for (long long t = 0; t < num_tasks; ++t) {
+                record.tasks_digest += task_hash(t);
+            }
+            record.complete_below = shard;
+            while (record.complete_below < num_tasks && done[record.complete_below]) {
+                record.complete_below_digest += task_hash(record.complete_below);
+                record.complete_below += shards;
+            }
+            record.complete_below = min(record.complete_below, num_tasks);
+            record.stats = stats;
+            record.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            if (first_found.load() != LLONG_MAX) {
+                record.counterexample_task = first_found.load();
+                record.counterexample = found;
+            }
+            record.write(opt.shard_output.empty() ? "shard-" + to_string(shard) + ".txt" : opt.shard_output);
+        }
+        if (first_found.load() != LLONG_MAX) {
+            show(found, C);
+            exit(1);
+        }
+    }
+};
+
+// Separator-line search engine. In a complete single-crossing profile, the voters which prefer
+// a to b and the voters which prefer b to a have disjoint bounding boxes that together cover
+// the grid, so they are separated by a single horizontal or vertical line (or one of them is
+// empty). Instead of deciding the preferences of one voter at a time, this engine decides
+// such a separator for one pair of candidates at a time and checks that the resulting orders
+// are transitive at every voter. It finds exactly the same profiles as backtr.
+struct SeparatorSearch {
+    int N, M, C, W;
+    // Possible sets of voters which prefer a to b, for a < b. Since voter (0, 0) prefers a
+    // to b, these are the whole grid and the half-grids above horizontal lines and to the
+    // left of vertical lines.
+    vector<vector<uint64_t>> sides;
+    // All voters.
+    vector<uint64_t> full;
+    // Unordered pairs of candidates in the order in which their separators are decided.
+    vector<pair<int, int>> pairs;
+    // Voters which prefer a to b (index a * C + b), for the pairs decided so far.
+    vector<vector<uint64_t>> prefer;
+    vector<bool> decided;
+    SeparatorSearch(const int _N, const int _M, const int _C):
+        N(_N), M(_M), C(_C), W((_N * _M + 63) / 64), full(W),
+        prefer(_C * _C, vector<uint64_t>(W)), decided(_C * _C) {
+        auto get_side = [&](auto inside) {
+            vector<uint64_t> side(W);
+            for (int r = 0; r < N; ++r) {
+                for (int c = 0; c < M; ++c) {
+                    if (inside(r, c)) {
+                        side[(r * M + c) / 64] |= uint64_t(1) << ((r * M + c) % 64);
+                    }
+                }
+            }
+            return side;
+        };
+        full = get_side([](int, int) { return true; });
+        sides.push_back(full);
+        for (int t = 1; t < N; ++t) {
+            sides.push_back(get_side([t](int r, int) { return r < t; }));
+        }
+        for (int t = 1; t < M; ++t) {
+            sides.push_back(get_side([t](int, int c) { return c < t; }));
+        }
+        for (int c1 = 1; c1 < C; ++c1) {
+            for (int c0 = 0; c0 < c1; ++c0) {
+                pairs.emplace_back(c0, c1);
+            }
+        }
+    }
+    // Returns whether some voter has the cyclic preferences x > y > z > x.
+    bool has_cycle(const int x, const int y, const int z) const {
+        const vector<uint64_t>& xy = prefer[x * C + y];
+        const vector<uint64_t>& yz = prefer[y * C + z];
+        const vector<uint64_t>& zx = prefer[z * C + x];
+        for (int w = 0; w < W; ++w) {
+            if (xy[w] & yz[w] & zx[w]) {
+                return true;
+            }
+        }
+        return false;
+    }
+    // Builds the profile described by the separators of all pairs.
+    Grid get_profile() const {
+        Grid g(N, M);
+        for (int r = 0; r < N; ++r) {
+            for (int c = 0; c < M; ++c) {
+                const int i = r * M + c;
+                uint64_t mask = prefs.masks[0];
+                for (const auto& [a, b] : pairs) {
+                    if (!(prefer[a * C + b][i / 64] >> (i % 64) & 1)) {
+                        mask ^= uint64_t(1) << pair_index(a, b);
+                    }
+                }
+                g[r][c] = PrefTable::id_of_mask(mask);
+            }
+        }
+        return g;
+    }
+    // Decides the separators of pairs[k], pairs[k + 1], ... in all possible ways.
+    void search(const size_t k, SearchStats& stats, const Options& opt) {
+        if (k == pairs.size()) {
+            const Grid g = get_profile();
+            if (!opt.no_fast_cross || !grid_has_fast_cross(g, C)) {
+                process_profile(g, C, stats);
+            }
+            return;
+        }
+        const int a = pairs[k].first, b = pairs[k].second;
+        decided[a * C + b] = decided[b * C + a] = true;
+        for (const vector<uint64_t>& side : sides) {
+            ++stats.nodes;
+            prefer[a * C + b] = side;
+            for (int w = 0; w < W; ++w) {
+                prefer[b * C + a][w] = full[w] & ~side[w];
+            }
+            bool ok = true;
+            for (int x = 0; x < C && ok; ++x) {
+                if (x != a && x != b && decided[a * C + x] && decided[b * C + x]) {
+                    ok = !has_cycle(a, b, x) && !has_cycle(b, a, x);
+                }
+            }
+            if (ok) {
+                search(k + 1, stats, opt);
+            }
+        }
+        decided[a * C + b] = decided[b * C + a] = false;
+    }
+};
+
+// Row-at-a-time search engine. A row is valid on its own if every pair of candidates changes
+// order at most once along it. Two rows can be stacked if and only if they split every pair in
+// the same way: either at the same column with the same candidate on the left, or not at all.
+// So the rows which can appear in a profile with a given first row form a class, which is
+// enumerated once. The remaining condition is that every pair which is not split is ordered
+// the same way in all voters of a row, and changes order at most once from one row to the
+// next. Among the rows of a class, the candidates for the next row are found by intersecting
+// bitsets of the rows ordering these pairs each way.
+struct RowSearch {
+    // All rows which split every pair of candidates in the same way.
+    struct RowClass {
+        vector<vector<PrefId>> rows;
+        // Pairs of candidates (by pair_index) which are not split by the rows of the class.
+        vector<int> uniform;
+        // Bit u of order[i] is set if row i prefers the smaller candidate of pair uniform[u].
+        vector<uint64_t> order;
+        // prefer[2 * u + o] is the bitset of rows for which bit u of order is o.
+        vector<vector<uint64_t>> prefer;
+    };
+    int N, M, C, P;
+    const Options& opt;
+    Grid g;
+    RowSearch(const Options& _opt):
+        N(_opt.N), M(_opt.M), C(_opt.C), P(_opt.C * (_opt.C - 1) / 2), opt(_opt),
+        g(_opt.N, _opt.M) {}
+    // Pair order masks restricted to the pairs of the C candidates in use.
+    uint64_t pair_mask(const PrefId p) const {
+        return prefs.masks[p] & ((uint64_t(1) << P) - 1);
+    }
+    bool has_fast_cross(const vector<PrefId>& row) const {
+        for (int c = 0; c + 1 < M; ++c) {
+            if (cnt_crosses(row[c], row[c + 1], C) > 1) {
+                return true;
+            }
+        }
+        return false;
+    }
+    // Appends to out all valid rows which start with the voters in row. changed is the set of
+    // pairs which change order within row.
+    void get_rows(vector<PrefId>& row, const uint64_t changed, vector<vector<PrefId>>& out) const {
+        if (static_cast<int>(row.size()) == M) {
+            out.push_back(row);
+            return;
+        }
+        const uint64_t last = pair_mask(row.back());
+        for (PrefId p = 0; p < PrefTable::factorial(C); ++p) {
+            const uint64_t diff = pair_mask(p) ^ last;
+            if ((diff & changed) == 0 && (!opt.no_fast_cross || __builtin_popcountll(diff) <= 1)) {
+                row.push_back(p);
+                get_rows(row, changed | diff, out);
+                row.pop_back();
+            }
+        }
+    }
+    // Returns how row splits each pair of candidates: 0 if it does not split it, and otherwise
+    // the set of voters of the row which prefer the smaller candidate.
+    vector<uint32_t> get_splits(const vector<PrefId>& row) const {
+        vector<uint32_t> ans(P);
+        for (int i = 0; i < P; ++i) {
+            for (int c = 0; c < M; ++c) {
+                ans[i] |= static_cast<uint32_t>(prefs.masks[row[c]] >> i & 1) << c;
+            }
+            if (ans[i] == (uint32_t(1) << M) - 1) {
+                ans[i] = 0;
+            }
+        }
+        return ans;
+    }
+    // Enumerates all rows with the given splits.
+    RowClass get_class(const vector<uint32_t>& splits) const {
+        RowClass ans;
+        for (int i = 0; i < P; ++i) {
+            if (splits[i] == 0) {
+                ans.uniform.push_back(i);
+            }
+        }
+        const int U = ans.uniform.size();
+        for (uint64_t order = 0; order < (uint64_t(1) << U); ++order) {
+            vector<PrefId> row(M);
+            bool ok = true;
+            for (int c = 0; c < M && ok; ++c) {
+                uint64_t mask = prefs.masks[0] & ~((uint64_t(1) << P) - 1);
+                for (int i = 0; i < P; ++i) {
+                    if (splits[i] != 0) {
+                        mask |= static_cast<uint64_t>(splits[i] >> c & 1) << i;
+                    }
+                }
+                for (int u = 0; u < U; ++u) {
+                    mask |= (order >> u & 1) << ans.uniform[u];
+                }
+                row[c] = PrefTable::id_of_mask(mask);
+                // Not every mask describes a transitive order.
+                ok = prefs.masks[row[c]] == mask;
+            }
+            if (ok && (!opt.no_fast_cross || !has_fast_cross(row))) {
+                ans.rows.push_back(row);
+                ans.order.push_back(order);
+            }
+        }
+        const int words = (ans.rows.size() + 63) / 64;
+        ans.prefer.assign(2 * U, vector<uint64_t>(words));
+        for (size_t i = 0; i < ans.rows.size(); ++i) {
+            for (int u = 0; u < U; ++u) {
+                ans.prefer[2 * u + (ans.order[i] >> u & 1)][i / 64] |= uint64_t(1) << (i % 64);
+            }
+        }
+        return ans;
+    }
+    // Calls f(path, changed) for every sequence path of len rows of cls which extends the rows in
+    // path and in which every unsplit pair changes order at most once. Rows are given by their
+    // index in cls.rows, and changed is the set of unsplit pairs (as in RowClass::order) which
+    // change order along path.
+    template <typename F>
+    void get_stacks(const RowClass& cls, vector<uint32_t>& path, const int len, const uint64_t changed,
+                    SearchStats& stats, F&& f) const {
+        if (static_cast<int>(path.size()) == len) {
+            f(path, changed);
+            return;
+        }
+        const uint32_t last = path.back();
+        const uint64_t order = cls.order[last];
+        vector<uint64_t> candidates((cls.rows.size() + 63) / 64, ~uint64_t(0));
+        for (int u = 0; u < static_cast<int>(cls.uniform.size()); ++u) {
+            if (changed >> u & 1) {
+                const vector<uint64_t>& allowed = cls.prefer[2 * u + (order >> u & 1)];
+                for (size_t w = 0; w < candidates.size(); ++w) {
+                    candidates[w] &= allowed[w];
+                }
+            }
+        }
+        for (size_t w = 0; w < candidates.size(); ++w) {
+            for (uint64_t x = candidates[w]; x != 0; x &= x - 1) {
+                const uint32_t i = w * 64 + __builtin_ctzll(x);
+                if (i >= cls.rows.size()) {
+                    break;
+                }
+                if (opt.no_fast_cross) {
+                    bool fast = false;
+                    for (int c = 0; c < M && !fast; ++c) {
+                        fast = cnt_crosses(cls.rows[last][c], cls.rows[i][c], C) > 1;
+                    }
+                    if (fast) {
+                        continue;
+                    }
+                }
+                ++stats.nodes;
+                path.push_back(i);
+                get_stacks(cls, path, len, changed | (cls.order[i] ^ order), stats, f);
+                path.pop_back();
+            }
+        }
+    }
+    // Returns the first rows, which start with voter (0, 0) having preferences 0 > ... > C - 1,
+    // grouped by the way in which they split the pairs of candidates (see get_splits).
+    map<vector<uint32_t>, vector<vector<PrefId>>> get_first_rows() const {
+        vector<vector<PrefId>> first_rows;
+        vector<PrefId> row(1, 0);
+        get_rows(row, 0, first_rows);
+        map<vector<uint32_t>, vector<vector<PrefId>>> groups;
+        for (const vector<PrefId>& first : first_rows) {
+            groups[get_splits(first)].push_back(first);
+        }
+        return groups;
+    }
+    // Calls f(g) for every complete profile g.
+    template <typename F>
+    void search(SearchStats& stats, F&& f) {
+        for (const auto& group : get_first_rows()) {
+            const RowClass cls = get_class(group.first);
+            for (const vector<PrefId>& first : group.second) {
+                vector<uint32_t> path(1, find(cls.rows.begin(), cls.rows.end(), first) - cls.rows.begin());
+                ++stats.nodes;
+                get_stacks(cls, path, N, 0, stats, [&](const vector<uint32_t>& rows, uint64_t) {
+                    for (int r = 0; r < N; ++r) {
+                        g.set_row(r, cls.rows[rows[r]]);
+                    }
+                    f(static_cast<const Grid&>(g));
+                });
+            }
+        }
+    }
+    void search(SearchStats& stats) {
+        search(stats, [&](const Grid& profile) { process_profile(profile, C, stats); });
+    }
+};
+
+// Meet-in-the-middle search engine for taller grids, built on RowSearch. With h = N / 2, every
+// profile of a row class consists of a top half (rows 0..h) and a bottom half (rows h..N - 1)
+// sharing row h. A top half and a bottom half sharing row h form a profile if and only if no
+// unsplit pair changes order in both of them. The bottom halves are stored in a hash table
+// keyed by their first row, grouped by the set of unsplit pairs which change order in them,
+// and the top halves are enumerated and joined with the matching groups. When the bottom halves
+// of a class would not fit in the memory budget, the class is processed in several passes
+// (as in a Grace hash join), each of which only handles the middle rows with a given residue.
+struct MeetInTheMiddleSearch {
+    struct BottomGroup {
+        uint64_t changed;
+        // N - 1 - h row indices (rows h + 1..N - 1) per bottom half.
+        vector<uint32_t> rows;
+    };
+    RowSearch base;
+    int N, h;
+    size_t budget_bytes;
+    unordered_map<uint32_t, vector<BottomGroup>> table;
+    MeetInTheMiddleSearch(const Options& opt):
+        base(opt), N(opt.N), h(opt.N / 2), budget_bytes(size_t(opt.mitm_budget_mb) << 20) {}
+    void search(SearchStats& stats) {
+        const int below = N - 1 - h;
+        Grid& g = base.g;
+        for (const auto& group : base.get_first_rows()) {
+            const RowSearch::RowClass cls = base.get_class(group.first);
+            // Count the bottom halves to choose the number of passes.
+            SearchStats counting;
+            long long bottoms = 0;
+            for (uint32_t i = 0; i < cls.rows.size(); ++i) {
+                vector<uint32_t> path(1, i);
+                base.get_stacks(cls, path, N - h, 0, counting, [&](const vector<uint32_t>&, uint64_t) { ++bottoms; });
+            }
+            const size_t bytes = bottoms * max<size_t>(1, below * sizeof(uint32_t));
+            const size_t passes = clamp<size_t>((bytes + budget_bytes - 1) / max<size_t>(1, budget_bytes),
+                                                1, cls.rows.size());
+            if (passes > 1) {
+                cerr << "Joining " << bottoms << " bottom halves in " << passes << " passes." << endl;
+            }
+            for (size_t pass = 0; pass < passes; ++pass) {
+                table.clear();
+                for (uint32_t i = pass; i < cls.rows.size(); i += passes) {
+                    vector<uint32_t> path(1, i);
+                    vector<BottomGroup>& bucket = table[i];
+                    ++stats.nodes;
+                    base.get_stacks(cls, path, N - h, 0, stats, [&](const vector<uint32_t>& rows, uint64_t changed) {
+                        auto it = find_if(bucket.begin(), bucket.end(),
+                                          [changed](const BottomGroup& b) { return b.changed == changed; });
+                        if (it == bucket.end()) {
+                            it = bucket.insert(bucket.end(), BottomGroup{changed, {}});
+                        }
+                        it->rows.insert(it->rows.end(), rows.begin() + 1, rows.end());
+                    });
+                }
+                for (const vector<PrefId>& first : group.second) {
+                    vector<uint32_t> path(1, find(cls.rows.begin(), cls.rows.end(), first) - cls.rows.begin());
+                    ++stats.nodes;
+                    base.get_stacks(cls, path, h + 1, 0, stats, [&](const vector<uint32_t>& rows, uint64_t changed) {
+                        if (rows.back() % passes != pass) {
+                            return;
+                        }
+                        for (int r = 0; r <= h; ++r) {
+                            g.set_row(r, cls.rows[rows[r]]);
+                        }
+                        for (const BottomGroup& b : table[rows.back()]) {
+                            if ((b.changed & changed) != 0) {
+                                continue;
+                            }
+                            // A single row has only one bottom half, which is empty below row h.
+                            const size_t halves = below == 0 ? 1 : b.rows.size() / below;
+                            for (size_t k = 0; k < halves; ++k) {
+                                for (int r = 0; r < below; ++r) {
+                                    g.set_row(h + 1 + r, cls.rows[b.rows[k * below + r]]);
+                                }
+                                process_profile(g, base.C, stats);
+                            }
+                        }
+                    });
+                }
+            }
+        }
+    }
+};
+
+// Dimension-growth search engine, which finds the profiles of the N x w grids for every
+// w = 1..M in a single sweep. Every valid N x w profile restricted to its first w - 1 columns
+// is a valid N x (w - 1) profile, so profiles are grown one column at a time, with the columns
+// given by a RowSearch on the transposed grid. Only the frontiers of the profiles are stored:
+// the last column, the unsplit pairs which already changed order (together deciding how the
+// profile can be extended) and the dominance boxes (deciding the hypotheses). Profiles with
+// the same frontier are merged, and each frontier keeps their number and the frontier it was
+// extended from, to print a counterexample. Profile digests are not computed.
+struct GrowthSearch {
+    struct Frontier {
+        uint32_t column;
+        uint64_t changed;
+        vector<Rect> dominance;
+        // Index of the frontier of the first w - 1 columns in the previous layer.
+        int parent;
+        long long count;
+    };
+    struct KeyHash {
+        size_t operator()(const vector<int>& key) const {
+            uint64_t h = 0;
+            for (const int x : key) {
+                h = splitmix64(h + static_cast<uint32_t>(x));
+            }
+            return h;
+        }
+    };
+    Options transposed;
+    RowSearch base;
+    int N, M, C;
+    static Options transpose(Options opt) {
+        swap(opt.N, opt.M);
+        return opt;
+    }
+    GrowthSearch(const Options& opt):
+        transposed(transpose(opt)), base(transposed), N(opt.N), M(opt.M), C(opt.C) {}
+    // Prints the N x (w + 1) profile ending at frontier k of layers[w].
+    void show_profile(const RowSearch::RowClass& cls, const vector<vector<Frontier>>& layers, int w, int k) const {
+        Grid g(N, w + 1);
+        for (; w >= 0; k = layers[w--][k].parent) {
+            for (int r = 0; r < N; ++r) {
+                g[r][w] = cls.rows[layers[w][k].column][r];
+            }
+        }
+        show(g, C);
+    }
+    void search(SearchStats& stats) {
+        vector<long long> profiles(M), frontiers(M);
+        for (const auto& group : base.get_first_rows()) {
+            const RowSearch::RowClass cls = base.get_class(group.first);
+            // tops[i][c] is the dominance box of candidate c within column i of the class.
+            vector<vector<Rect>> tops(cls.rows.size(), vector<Rect>(C));
+            for (size_t i = 0; i < cls.rows.size(); ++i) {
+                for (int r = 0; r < N; ++r) {
+                    tops[i][top(cls.rows[i][r])] = tops[i][top(cls.rows[i][r])].add(r, 0);
+                }
+            }
+            // layers[w] holds the frontiers of the N x (w + 1) profiles.
+            vector<vector<Frontier>> layers(M);
+            for (const vector<PrefId>& first : group.second) {
+                const uint32_t i = find(cls.rows.begin(), cls.rows.end(), first) - cls.rows.begin();
+                ++stats.nodes;
+                layers[0].push_back(Frontier{i, 0, tops[i], -1, 1});
+            }
+            for (int w = 0; w < M; ++w) {
+                if (w > 0) {
+                    unordered_map<vector<int>, int, KeyHash> index;
+                    vector<int> key(3 + 4 * C);
+                    for (size_t k = 0; k < layers[w - 1].size(); ++k) {
+                        const Frontier& f = layers[w - 1][k];
+                        vector<uint32_t> path(1, f.column);
+                        base.get_stacks(cls, path, 2, f.changed, stats, [&](const vector<uint32_t>& columns, uint64_t changed) {
+                            vector<Rect> dominance = f.dominance;
+                            for (int c = 0; c < C; ++c) {
+                                const Rect& x = tops[columns[1]][c];
+                                if (x.r0 != INF) {
+                                    dominance[c] = dominance[c].add(x.r0, w).add(x.r1, w);
+                                }
+                            }
+                            key[0] = columns[1];
+                            key[1] = static_cast<uint32_t>(changed);
+                            key[2] = static_cast<uint32_t>(changed >> 32);
+                            for (int c = 0; c < C; ++c) {
+                                key[3 + 4 * c] = dominance[c].r0;
+                                key[4 + 4 * c] = dominance[c].r1;
+                                key[5 + 4 * c] = dominance[c].c0;
+                                key[6 + 4 * c] = dominance[c].c1;
+                            }
+                            const auto it = index.emplace(key, layers[w].size());
+                            if (it.second) {
+                                layers[w].push_back(Frontier{columns[1], changed, move(dominance),
+                                                             static_cast<int>(k), f.count});
+                            } else {
+                                layers[w][it.first->second].count += f.count;
+                            }
+                        });
+                    }
+                }
+                frontiers[w] += layers[w].size();
+                for (size_t k = 0; k < layers[w].size(); ++k) {
+                    profiles[w] += layers[w][k].count;
+                    if (is_counterexample(layers[w][k].dominance, N, w + 1)) {
+                        show_profile(cls, layers, w, k);
+                        exit(1);
+                    }
+                }
+            }
+        }
+        for (int w = 0; w < M; ++w) {
+            cerr << "Grid " << N << " x " << w + 1 << ": " << profiles[w] << " grid profiles in "
+                 << frontiers[w] << " frontiers." << endl;
+        }
+        stats.profiles = profiles[M - 1];
+    }
+};
+
+// Candidate-growth search engine. Deleting candidate c from a complete single-crossing profile
+// over c + 1 candidates leaves a single-crossing profile over c candidates (in which voter
+// (0, 0) still prefers 0 > ... > c - 1), so the profiles over C candidates are found by storing
+// the profiles over fewer candidates (found by RowSearch) and inserting the other candidates
+// one at a time into the lists of all voters. Inserting c into list p so that it is preferred
+// to k of the candidates 0, ..., c - 1 gives list p + k * c! (see PrefTable). Only the pairs
+// (x, c) can become invalid, so the insertion positions are decided cell by cell in row-major
+// order, keeping the bounding boxes of both sides of these pairs disjoint.
+struct CandidateSearch {
+    int N, M, C, base_c;
+    const Options& opt;
+    Grid g;
+    // sides[c][2 * x + o] is the bounding box of the voters preferring x to c if o = 0, and
+    // c to x if o = 1.
+    vector<vector<Rect>> sides;
+    // Number of profiles found over each number of candidates.
+    vector<long long> profiles;
+    CandidateSearch(const Options& _opt):
+        N(_opt.N), M(_opt.M), C(_opt.C),
+        base_c(_opt.base_candidates == 0 ? max(1, _opt.C - 1) : _opt.base_candidates), opt(_opt),
+        g(_opt.N, _opt.M), sides(_opt.C), profiles(_opt.C + 1) {
+        if (base_c < 1 || base_c > C) {
+            throw invalid_argument("The number of base candidates must be between 1 and C.");
+        }
+        for (int c = 0; c < C; ++c) {
+            sides[c].resize(2 * c);
+        }
+    }
+    // Called for every complete profile over c candidates.
+    void found(const int c, SearchStats& stats) {
+        ++profiles[c];
+        if (c == C) {
+            process_profile(g, C, stats);
+        } else {
+            if (is_counterexample(get_dominance_boxes(g, c), N, M)) {
+                show(g, c);
+                exit(1);
+            }
+            fill(sides[c].begin(), sides[c].end(), Rect());
+            extend(c, 0, stats);
+        }
+    }
+    // Inserts candidate c into the lists of the voters from the given cell on (in row-major order).
+    void extend(const int c, const int cell, SearchStats& stats) {
+        if (cell == N * M) {
+            found(c + 1, stats);
+            return;
+        }
+        const int r = cell / M, j = cell % M;
+        const PrefId p = g[r][j];
+        const PrefId weight = PrefTable::factorial(c);
+        vector<Rect>& side = sides[c];
+        const vector<Rect> saved = side;
+        // Voter (0, 0) keeps preferring the candidates in order.
+        const int max_k = cell == 0 ? 0 : c;
+        for (int k = 0; k <= max_k; ++k) {
+            const PrefId q = p + k * weight;
+            if (opt.no_fast_cross && ((r > 0 && cnt_crosses(q, g[r - 1][j], c + 1) > 1) ||
+                                      (j > 0 && cnt_crosses(q, g[r][j - 1], c + 1) > 1))) {
+                continue;
+            }
+            bool ok = true;
+            for (int x = 0; x < c && ok; ++x) {
+                const int o = prefers(q, x, c) ? 0 : 1;
+                side[2 * x + o] = side[2 * x + o].add(r, j);
+                ok = !do_intersect(side[2 * x], side[2 * x + 1]);
+            }
+            ++stats.nodes;
+            if (ok) {
+                g[r][j] = q;
+                extend(c, cell + 1, stats);
+            }
+            side = saved;
+        }
+        g[r][j] = p;
+    }
+    void search(SearchStats& stats) {
+        Options base_opt = opt;
+        base_opt.C = base_c;
+        RowSearch base(base_opt);
+        vector<Grid> grids;
+        base.search(stats, [&](const Grid& h) { grids.push_back(h); });
+        for (const Grid& h : grids) {
+            g = h;
+            found(base_c, stats);
+        }
+        for (int c = base_c; c <= C; ++c) {
+            cerr << c << " candidates: " << profiles[c] << " grid profiles." << endl;
+        }
+    }
+};
+
+// Searches for a complete single-crossing profile over C candidates with a given top-choice
+// map, given by the rectangles (one per candidate, possibly empty) of the voters with each top
+// choice. The voters with top choice t prefer t to every other candidate x, which gives a part
+// of the box of (t, x) before placing any voter. With it, get_forced_orders forces the top
+// choice of every voter, and conflicts between distant voters show up early. Voters are then
+// placed in row-major order, only trying the lists respecting the forced orders, with forward
+// checking. If normalized, voter (0, 0) prefers the candidates in order.
+struct MapRealizer {
+    int N, M, C;
+    bool normalized, no_fast_cross;
+    Grid g;
+    PairBoxes v;
+    MapRealizer(const int _N, const int _M, const int _C, const bool _normalized, const bool _no_fast_cross):
+        N(_N), M(_M), C(_C), normalized(_normalized), no_fast_cross(_no_fast_cross),
+        g(_N, _M), v(_C) {}
+    // Returns whether the voters from the given cell on (in row-major order) can be completed,
+    // in which case g holds the completed profile.
+    bool complete(const int cell, SearchStats& stats) {
+        if (cell == N * M) {
+            return true;
+        }
+        const int r = cell / M, c = cell % M;
+        vector<uint32_t> before;
+        if (!get_forced_orders(v, C, r, c, before)) {
+            return false;
+        }
+        vector<PrefId> options;
+        get_linear_extensions(before, C, options);
+        for (const PrefId p : options) {
+            if ((normalized && cell == 0 && p != 0) ||
+                (no_fast_cross && ((r > 0 && cnt_crosses(p, g[r - 1][c], C) > 1) ||
+                                   (c > 0 && cnt_crosses(p, g[r][c - 1], C) > 1)))) {
+                continue;
+            }
+            ++stats.nodes;
+            const size_t marker = v.checkpoint();
+            g[r][c] = p;
+            if (v.add(p, r, c) && forward_check(g, v, C) && complete(cell + 1, stats)) {
+                return true;
+            }
+            g[r][c] = EmptyProf;
+            v.rollback(marker);
+        }
+        return false;
+    }
+    // Returns whether some profile has the top-choice map given by regions, which must cover
+    // the grid. If so, g holds the first such profile found.
+    bool realize(const vector<Rect>& regions, SearchStats& stats) {
+        g.fill(EmptyProf);
+        const size_t marker = v.checkpoint();
+        bool ok = true;
+        for (int t = 0; t < C && ok; ++t) {
+            for (int x = 0; x < C && ok && regions[t].r0 != INF; ++x) {
+                ok = x == t || v.add_rect(t, x, regions[t]);
+            }
+        }
+        ok = ok && complete(0, stats);
+        v.rollback(marker);
+        return ok;
+    }
+};
+
+// Decides whether the tiling of an N x M grid into the nonempty rectangles regions is the
+// dominance tiling of some profile over K = regions.size() candidates (see TilingSearch for why
+// K candidates are enough), without placing any voter. Every pair (x, y) of candidates has to
+// be split by a line with regions[x] on the side of x and regions[y] on the side of y (it cannot
+// be uniform since both regions are nonempty), and conversely any choice of such lines gives a
+// profile as long as no voter gets cyclic orders x > y > z > x. The sides of these lines are
+// half-planes, so such a voter exists if and only if three of them intersect. The lines of the
+// pairs are chosen by backtracking, fewest options first, checking each triple of candidates as
+// soon as the lines of its three pairs are chosen. Without fast crosses, no two pairs may be
+// split by the same line.
+struct SeparatorRealizer {
+    struct Option {
+        // Voters preferring x to y and voters preferring y to x.
+        Rect first, second;
+        // Lines 0..N - 2 are horizontal (below the row of the same number), the others vertical.
+        int line;
+    };
+    int N, M, K;
+    bool distinct_lines;
+    vector<pair<int, int>> pairs;
+    vector<vector<Option>> options;
+    // sides[x * K + y] is the half-plane of the voters preferring x to y, once decided.
+    vector<Rect> sides;
+    vector<bool> decided, used_lines;
+    SeparatorRealizer(const int _N, const int _M, const vector<Rect>& regions, const bool _distinct_lines):
+        N(_N), M(_M), K(regions.size()), distinct_lines(_distinct_lines), sides(K * K),
+        decided(K * K), used_lines(_N + _M) {
+        for (int y = 1; y < K; ++y) {
+            for (int x = 0; x < y; ++x) {
+                vector<Option> xy;
+                const Rect& a = regions[x];
+                const Rect& b = regions[y];
+                for (int i = 0; i + 1 < N; ++i) {
+                    const Rect above(0, i, 0, M - 1), below(i + 1, N - 1, 0, M - 1);
+                    if (a.r1 <= i && i < b.r0) {
+                        xy.push_back(Option{above, below, i});
+                    } else if (b.r1 <= i && i < a.r0) {
+                        xy.push_back(Option{below, above, i});
+                    }
+                }
+                for (int j = 0; j + 1 < M; ++j) {
+                    const Rect left(0, N - 1, 0, j), right(0, N - 1, j + 1, M - 1);
+                    if (a.c1 <= j && j < b.c0) {
+                        xy.push_back(Option{left, right, N + j});
+                    } else if (b.c1 <= j && j < a.c0) {
+                        xy.push_back(Option{right, left, N + j});
+                    }
+                }
+                pairs.emplace_back(x, y);
+                options.push_back(xy);
+            }
+        }
+        vector<int> order(pairs.size());
+        iota(order.begin(), order.end(), 0);
+        stable_sort(order.begin(), order.end(), [&](int i, int j) { return options[i].size() < options[j].size(); });
+        vector<pair<int, int>> sorted_pairs;
+        vector<vector<Option>> sorted_options;
+        for (const int i : order) {
+            sorted_pairs.push_back(pairs[i]);
+            sorted_options.push_back(options[i]);
+        }
+        pairs.swap(sorted_pairs);
+        options.swap(sorted_options);
+    }
+    static bool have_common_voter(const Rect& a, const Rect& b, const Rect& c) {
+        return max({a.r0, b.r0, c.r0}) <= min({a.r1, b.r1, c.r1}) &&
+               max({a.c0, b.c0, c.c0}) <= min({a.c1, b.c1, c.c1});
+    }
+    bool search(const size_t k, SearchStats& stats) {
+        if (k == pairs.size()) {
+            return true;
+        }
+        const int x = pairs[k].first, y = pairs[k].second;
+        for (const Option& o : options[k]) {
+            if (distinct_lines && used_lines[o.line]) {
+                continue;
+            }
+            ++stats.nodes;
+            sides[x * K + y] = o.first;
+            sides[y * K + x] = o.second;
+            bool ok = true;
+            for (int z = 0; z < K && ok; ++z) {
+                if (decided[x * K + z] && decided[y * K + z]) {
+                    ok = !have_common_voter(sides[x * K + y], sides[y * K + z], sides[z * K + x]) &&
+                         !have_common_voter(sides[y * K + x], sides[x * K + z], sides[z * K + y]);
+                }
+            }
+            if (ok) {
+                decided[x * K + y] = decided[y * K + x] = true;
+                used_lines[o.line] = true;
+                const bool found = search(k + 1, stats);
+                decided[x * K + y] = decided[y * K + x] = false;
+                used_lines[o.line] = false;
+                if (found) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+    // Returns the profile given by the chosen lines, over C >= K candidates (candidates K, ...,
+    // C - 1 are at the end of every list). Only valid right after search returned true, which
+    // leaves the lines of the last search path in sides.
+    Grid get_profile() const {
+        Grid g(N, M);
+        for (int r = 0; r < N; ++r) {
+            for (int c = 0; c < M; ++c) {
+                uint64_t mask = prefs.masks[0] & ~((uint64_t(1) << (K * (K - 1) / 2)) - 1);
+                for (int y = 1; y < K; ++y) {
+                    for (int x = 0; x < y; ++x) {
+                        if (do_intersect(sides[x * K + y], Rect().add(r, c))) {
+                            mask |= uint64_t(1) << pair_index(x, y);
+                        }
+                    }
+                }
+                g[r][c] = PrefTable::id_of_mask(mask);
+            }
+        }
+        return g;
+    }
+};
+
+// Top-choice-map-first search engine. The hypotheses only depend on the most preferred
+// candidate of every voter, so this engine enumerates top-choice maps (a candidate per voter)
+// and passes one profile realizing each of them (see MapRealizer) to process_profile. Each
+// realizable map is thus processed exactly once. In a single-crossing profile the voters with
+// top choice c are the ones on the side of c of the separator lines of all pairs (c, x), so
+// they form a rectangle: maps are built in row-major order keeping the bounding boxes of the
+// candidates disjoint.
+struct TopMapSearch {
+    int N, M, C;
+    // Bounding box of the voters labeled with each candidate.
+    vector<Rect> regions;
+    MapRealizer realizer;
+    long long maps = 0;
+    TopMapSearch(const Options& opt):
+        N(opt.N), M(opt.M), C(opt.C), regions(opt.C), realizer(opt.N, opt.M, opt.C, true, opt.no_fast_cross) {}
+    // Labels the voters from the given cell on (in row-major order).
+    void enumerate(const int cell, SearchStats& stats) {
+        if (cell == N * M) {
+            ++maps;
+            if (realizer.realize(regions, stats)) {
+                process_profile(realizer.g, C, stats);
+            }
+            return;
+        }
+        const int r = cell / M, c = cell % M;
+        // Voter (0, 0) prefers candidate 0 to all others.
+        for (int t = 0; t < (cell == 0 ? 1 : C); ++t) {
+            const Rect grown = regions[t].add(r, c);
+            bool ok = true;
+            for (int x = 0; x < C && ok; ++x) {
+                ok = x == t || !do_intersect(grown, regions[x]);
+            }
+            if (ok) {
+                const Rect saved = regions[t];
+                regions[t] = grown;
+                enumerate(cell + 1, stats);
+                regions[t] = saved;
+            }
+        }
+    }
+    void search(SearchStats& stats) {
+        enumerate(0, stats);
+        cerr << "Found " << stats.profiles << " realizable top-choice maps out of " << maps
+             << " rectangular ones." << endl;
+    }
+};
+
+// Tiling-first search engine. Every tiling of the grid into at most C rectangles is
+// enumerated, and the ones which are not counterexamples to the hypotheses (e.g. the ones
+// admitting a split line) are dropped. For each remaining tiling with k rectangles, the
+// engine decides whether it is the dominance tiling of some profile. Relabeling the candidates
+// of a profile does not change its validity, and neither do deleting candidates which are
+// nobody's top choice or appending new candidates at the end of all lists. So the tiling is
+// realizable over C candidates if and only if the map labeling its rectangles 0, ..., k - 1 is
+// realizable over k candidates (with any preferences for voter (0, 0)). Tilings are built by
+// covering the first free cell (in row-major order) with a rectangle having it as its top-left
+// corner, which gives each tiling exactly once.
+// In particular, the minimum number of candidates for which a tiling is the dominance tiling of
+// some profile is its number of rectangles if it is realizable at all. With report, the engine
+// prints this for every tiling, with a witness, and a table of the tilings by number of
+// rectangles, which tells which numbers of candidates can give counterexamples.
+struct TilingSearch {
+    int N, M, C;
+    const Options& opt;
+    bool report;
+    // Rectangle covering each cell, or -1.
+    vector<vector<int>> owner;
+    vector<Rect> rects;
+    long long tilings = 0, candidates = 0;
+    // table[k] counts the tilings with k rectangles: all, realizable, counterexamples and
+    // realizable counterexamples.
+    vector<array<long long, 4>> table;
+    TilingSearch(const Options& _opt, const bool _report):
+        N(_opt.N), M(_opt.M), C(_opt.C), opt(_opt), report(_report),
+        owner(_opt.N, vector<int>(_opt.M, -1)), table(_opt.C + 1) {}
+    void print_minimum(SearchStats& stats) {
+        const int k = rects.size();
+        SeparatorRealizer realizer(N, M, rects, opt.no_fast_cross);
+        const bool realizable = realizer.search(0, stats);
+        const bool counterexample = is_counterexample(rects, N, M);
+        ++table[k][0];
+        table[k][1] += realizable;
+        table[k][2] += counterexample;
+        table[k][3] += realizable && counterexample;
+        cout << "Tiling " << tilings << " (" << k << " rectangles" << (counterexample ? ", no split line" : "")
+             << "): ";
+        if (realizable) {
+            ++stats.profiles;
+            cout << "minimum C = " << k << endl;
+            show(realizer.get_profile(), k);
+        } else {
+            cout << "not realizable" << endl;
+            for (const vector<int>& row : owner) {
+                for (const int x : row) {
+                    cout << x;
+                }
+                cout << endl;
+            }
+            cout << "####" << endl;
+        }
+    }
+    void test(SearchStats& stats) {
+        ++tilings;
+        if (report) {
+            print_minimum(stats);
+            return;
+        }
+        if (!is_counterexample(rects, N, M)) {
+            return;
+        }
+        ++candidates;
+        MapRealizer realizer(N, M, rects.size(), false, opt.no_fast_cross);
+        if (realizer.realize(rects, stats)) {
+            process_profile(realizer.g, C, stats);
+        }
+    }
+    void enumerate(int cell, SearchStats& stats) {
+        while (cell < N * M && owner[cell / M][cell % M] != -1) {
+            ++cell;
+        }
+        if (cell == N * M) {
+            test(stats);
+            return;
+        }
+        if (static_cast<int>(rects.size()) == C) {
+            return;
+        }
+        const int r = cell / M, c = cell % M;
+        for (int c1 = c; c1 < M && owner[r][c1] == -1; ++c1) {
+            for (int r1 = r; r1 < N; ++r1) {
+                ++stats.nodes;
+                rects.push_back(Rect().add(r, c).add(r1, c1));
+                for (int i = r; i <= r1; ++i) {
+                    for (int j = c; j <= c1; ++j) {
+                        owner[i][j] = rects.size() - 1;
+                    }
+                }
+                enumerate(cell + 1, stats);
+                for (int i = r; i <= r1; ++i) {
+                    for (int j = c; j <= c1; ++j) {
+                        owner[i][j] = -1;
+                    }
+                }
+                rects.pop_back();
+            }
+        }
+    }
+    void search(SearchStats& stats) {
+        enumerate(0, stats);
+        if (!report) {
+            cerr << "Found " << tilings << " tilings into at most " << C << " rectangles, " << candidates
+                 << " of which would be counterexamples, and " << stats.profiles << " of these are realizable."
+                 << endl;
+            return;
+        }
+        int first = 0;
+        for (int k = 1; k <= C; ++k) {
+            cerr << k << " rectangles: " << table[k][0] << " tilings (" << table[k][1] << " realizable), "
+                 << table[k][2] << " counterexamples (" << table[k][3] << " realizable)." << endl;
+            if (first == 0 && table[k][3] > 0) {
+                first = k;
+            }
+        }
+        if (first > 0) {
+            cerr << "Runs on " << N << " x " << M << " grids can only contain counterexamples for C >= "
+                 << first << "." << endl;
+        } else {
+            cerr << "No run on " << N << " x " << M << " grids with C <= " << C << " can contain counterexamples."
+                 << endl;
+        }
+    }
+};
+
+// Pinwheel-embedding search engine. The smallest tilings without a split line (other than the
+// trivial one) are the pinwheels: a central rectangle not touching the sides of the grid,
+// surrounded by four rectangles each touching two sides, turning clockwise or anticlockwise.
+// This engine tests every pinwheel tiling of every n x m grid with 3 <= n <= N, 3 <= m <= M with
+// SeparatorRealizer, which takes time polynomial in the grid size, so it reaches far larger
+// grids than the exhaustive engines. It needs C >= 5, and fewer candidates never help.
+struct PinwheelSearch {
+    int N, M, C;
+    const Options& opt;
+    long long pinwheels = 0;
+    PinwheelSearch(const Options& _opt): N(_opt.N), M(_opt.M), C(_opt.C), opt(_opt) {}
+    void search(SearchStats& stats) {
+        if (C < 5) {
+            cerr << "Pinwheels need at least 5 candidates." << endl;
+            return;
+        }
+        for (int n = 3; n <= N; ++n) {
+            for (int m = 3; m <= M; ++m) {
+                // The central rectangle covers rows a..b and columns c..d.
+                for (int a = 1; a + 1 < n; ++a) {
+                    for (int b = a; b + 1 < n; ++b) {
+                        for (int c = 1; c + 1 < m; ++c) {
+                            for (int d = c; d + 1 < m; ++d) {
+                                const vector<Rect> clockwise = {Rect(a, b, c, d), Rect(0, a - 1, 0, d),
+                                    Rect(0, b, d + 1, m - 1), Rect(b + 1, n - 1, c, m - 1), Rect(a, n - 1, 0, c - 1)};
+                                const vector<Rect> anticlockwise = {Rect(a, b, c, d), Rect(0, b, 0, c - 1),
+                                    Rect(0, a - 1, c, m - 1), Rect(a, n - 1, d + 1, m - 1), Rect(b + 1, n - 1, 0, d)};
+                                for (const vector<Rect>& regions : {clockwise, anticlockwise}) {
+                                    ++pinwheels;
+                                    SeparatorRealizer realizer(n, m, regions, opt.no_fast_cross);
+                                    if (realizer.search(0, stats)) {
+                                        process_profile(realizer.get_profile(), C, stats);
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        cerr << "Tested " << pinwheels << " pinwheel tilings of grids up to " << N << " x " << M
+             << ", " << stats.profiles << " of them realizable." << endl;
+    }
+};
+
+// Search engine specialized at compile time on the grid size N x M and the number C of
+// candidates, for the usual configuration of backtr (boxes backend, linear extension
+// enumeration and row-major order), which it matches profile for profile and node for node.
+// The profile and the boxes are kept in std::arrays, and the loops over the pairs of candidates
+// are unrolled over a constexpr table of the pairs.
+template <int N, int M, int C>
+struct FixedSearch {
+    static constexpr int P = C * (C - 1) / 2;
+    // pairs[pair_index(x, y)] = (x, y).
+    static constexpr array<array<int, 2>, P> pairs = [] {
+        array<array<int, 2>, P> ans{};
+        for (int y = 1; y < C; ++y) {
+            for (int x = 0; x < y; ++x) {
+                ans[pair_index(x, y)][0] = x;
+                ans[pair_index(x, y)][1] = y;
+            }
+        }
+        return ans;
+    }();
+    const Options& opt;
+    array<PrefId, N * M> g;
+    // boxes[x * C + y] is the bounding box of the voters preferring x to y.
+    array<Rect, C * C> boxes;
+    // Copy of g passed to process_profile.
+    Grid grid;
+    FixedSearch(const Options& _opt): opt(_opt), grid(N, M) {}
+    // Calls f(x, y, pair_index(x, y)) for all pairs x < y, until it returns false. Returns
+    // whether it never did.
+    template <typename F, size_t... I>
+    static bool all_pairs(F&& f, index_sequence<I...>) {
+        return (f(pairs[I][0], pairs[I][1], I) && ...);
+    }
+    void search(const int cell, SearchStats& stats) {
+        if (cell == N * M) {
+            copy(g.begin(), g.end(), grid.cells.begin());
+            process_profile(grid, C, stats);
+            return;
+        }
+        if (cell == 0) {
+            // The first voter is assumed to always have preferences 0 > ... > C - 1 (id 0).
+            place(0, cell, stats);
+            return;
+        }
+        const int r = cell / M, c = cell % M;
+        // Forced orders, as in get_forced_orders.
+        array<uint32_t, C> before{};
+        const bool ok = all_pairs([&](const int x, const int y, size_t) {
+            const Rect& xy = boxes[x * C + y];
+            const Rect& yx = boxes[y * C + x];
+            const bool x_first = !do_intersect(xy.add(r, c), yx);
+            const bool y_first = !do_intersect(yx.add(r, c), xy);
+            if (!y_first) {
+                before[y] |= 1u << x;
+            } else if (!x_first) {
+                before[x] |= 1u << y;
+            }
+            return x_first || y_first;
+        }, make_index_sequence<P>());
+        if (ok) {
+            extend(before, (1u << C) - 1, 0, cell, stats);
+        }
+    }
+    // Places the voter of the given cell with every linear extension of before, as in
+    // get_linear_extensions.
+    void extend(const array<uint32_t, C>& before, const uint32_t rest, const PrefId id, const int cell,
+                SearchStats& stats) {
+        if (rest == 0) {
+            place(id, cell, stats);
+            return;
+        }
+        for (int x = 0; x < C; ++x) {
+            if ((rest >> x & 1) && (before[x] & rest) == 0) {
+                const int k = __builtin_popcount(rest & ((1u << x) - 1));
+                extend(before, rest & ~(1u << x), id + k * PrefTable::factorial(x), cell, stats);
+            }
+        }
+    }
+    void place(const PrefId p, const int cell, SearchStats& stats) {
+        const int r = cell / M, c = cell % M;
+        ++stats.nodes;
+        if (opt.no_fast_cross && ((r > 0 && cnt_crosses(p, g[cell - M], C) > 1) ||
+                                  (c > 0 && cnt_crosses(p, g[cell - 1], C) > 1))) {
+            return;
+        }
+        const array<Rect, C * C> saved = boxes;
+        const uint64_t mask = prefs.masks[p];
+        all_pairs([&](const int x, const int y, const size_t i) {
+            Rect& b = (mask >> i & 1) ? boxes[x * C + y] : boxes[y * C + x];
+            b = b.add(r, c);
+            return true;
+        }, make_index_sequence<P>());
+        g[cell] = p;
+        search(cell + 1, stats);
+        boxes = saved;
+    }
+};
+
+using FixedRunner = void (*)(const Options&, SearchStats&);
+
+template <int N, int M, int C>
+void run_fixed(const Options& opt, SearchStats& stats) {
+    FixedSearch<N, M, C> search(opt);
+    search.search(0, stats);
+}
+
+// The sizes for which FixedSearch is compiled: the settings recorded in the header. Every
+// instantiation costs several seconds of compile time, and the generic search is as fast on
+// most other sizes.
+const struct {
+    int N, M, C;
+    FixedRunner run;
+} fixed_sizes[] = {{8, 8, 4, &run_fixed<8, 8, 4>},
+                   {4, 5, 5, &run_fixed<4, 5, 5>},
+                   {3, 6, 5, &run_fixed<3, 6, 5>},
+                   {3, 3, 6, &run_fixed<3, 3, 6>},
+                   {6, 6, 6, &run_fixed<6, 6, 6>}};
+
+// Returns the FixedSearch of an N x M grid with C candidates, or null if it is not compiled.
+FixedRunner find_fixed(const int N, const int M, const int C) {
+    for (const auto& x : fixed_sizes) {
+        if (x.N == N && x.M == M && x.C == C) {
+            return x.run;
+        }
+    }
+    return nullptr;
+}
+
+// Same as stoi/stod, but rejects trailing characters and reports every malformed or
+// out-of-range number as invalid_argument (stoi/stod throw out_of_range for the latter).
+int parse_int(const string& s) {
+    size_t end = 0;
+    int x;
+    try {
+        x = stoi(s, &end);
+    } catch (const logic_error&) {
+        end = 0;
+    }
+    if (end == 0 || end != s.size()) {
+        throw invalid_argument("Expected an integer, got: " + s);
+    }
+    return x;
+}
+
+double parse_double(const string& s) {
+    size_t end = 0;
+    double x;
+    try {
+        x = stod(s, &end);
+    } catch (const logic_error&) {
+        end = 0;
+    }
+    if (end == 0 || end != s.size()) {
+        throw invalid_argument("Expected a number, got: " + s);
+    }
+    return x;
+}
+
+Options parse_options(const int argc, char** argv) {
+    Options opt;
+    vector<int> dims;
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+        if (arg.rfind("--engine=", 0) == 0) {
+            opt.engine = arg.substr(strlen("--engine="));
+        } else if (arg.rfind("--backend=", 0) == 0) {
+            opt.backend = arg.substr(strlen("--backend="));
+        } else if (arg == "--enumeration=lex") {
+            opt.enumeration = Enumeration::Lex;
+        } else if (arg == "--enumeration=adjacent") {
+            opt.enumeration = Enumeration::AdjacentSwaps;
+        } else if (arg == "--enumeration=extensions") {
+            opt.enumeration = Enumeration::Extensions;
+        } else if (arg == "--no-fast-cross") {
+            opt.no_fast_cross = true;
+        } else if (arg == "--forward-check") {
+            opt.forward_check = true;
+        } else if (arg == "--symmetry") {
+            opt.symmetry = true;
+        } else if (arg == "--order=rows") {
+            opt.cell_order = CellOrder::RowMajor;
+        } else if (arg == "--order=boustrophedon") {
+            opt.cell_order = CellOrder::Boustrophedon;
+        } else if (arg == "--order=diagonal") {
+            opt.cell_order = CellOrder::Diagonal;
+        } else if (arg == "--order=constrained") {
+            opt.cell_order = CellOrder::MostConstrained;
+        } else if (arg.rfind("--mitm-budget=", 0) == 0) {
+            opt.mitm_budget_mb = parse_int(arg.substr(strlen("--mitm-budget=")));
+        } else if (arg.rfind("--base-candidates=", 0) == 0) {
+            opt.base_candidates = parse_int(arg.substr(strlen("--base-candidates=")));
+        } else if (arg.rfind("--memo=", 0) == 0) {
+            opt.memo_log_size = parse_int(arg.substr(strlen("--memo=")));
+            if (opt.memo_log_size < 1 || opt.memo_log_size > 32) {
+                throw invalid_argument("The log size of the transposition table must be between 1 and 32.");
+            }
+        } else if (arg.rfind("--checkpoint=", 0) == 0) {
+            opt.checkpoint_path = arg.substr(strlen("--checkpoint="));
+        } else if (arg.rfind("--checkpoint-every=", 0) == 0) {
+            opt.checkpoint_seconds = parse_double(arg.substr(strlen("--checkpoint-every=")));
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            opt.threads = parse_int(arg.substr(strlen("--threads=")));
+        } else if (arg.rfind("--prefix-depth=", 0) == 0) {
+            opt.prefix_depth = parse_int(arg.substr(strlen("--prefix-depth=")));
+        } else if (arg.rfind("--checkers=", 0) == 0) {
+            opt.checkers = parse_int(arg.substr(strlen("--checkers=")));
+        } else if (arg.rfind("--ring-size=", 0) == 0) {
+            opt.ring_size = parse_int(arg.substr(strlen("--ring-size=")));
+        } else if (arg.rfind("--shard=", 0) == 0) {
+            opt.shard = parse_int(arg.substr(strlen("--shard=")));
+        } else if (arg.rfind("--shards=", 0) == 0) {
+            opt.shards = parse_int(arg.substr(strlen("--shards=")));
+        } else if (arg.rfind("--shard-output=", 0) == 0) {
+            opt.shard_output = arg.substr(strlen("--shard-output="));
+        } else if (arg == "--merge") {
+            opt.merge_files.assign(argv + i + 1, argv + argc);
+            if (opt.merge_files.empty()) {
+                throw invalid_argument("Expected the shard records to merge.");
+            }
+            break;
+        } else if (arg == "--bench-orders") {
+            opt.bench_orders = true;
+        } else if (!arg.empty() && isdigit(arg[0])) {
+            dims.push_back(parse_int(arg));
+        } else {
+            throw invalid_argument("Unknown argument: " + arg);
+        }
+    }
+    if (!dims.empty()) {
+        if (dims.size() != 3) {
+            throw invalid_argument("Expected the dimensions as N M C.");
+        }
+        opt.N = dims[0];
+        opt.M = dims[1];
+        opt.C = dims[2];
+    }
+    if (opt.N <= 0 || opt.M <= 0 || opt.C <= 0) {
+        throw invalid_argument("N, M and C must be positive.");
+    }
+    return opt;
+}
+
+// Runs the search described by opt, returning its statistics and the elapsed time in seconds.
+pair<SearchStats, double> run_search(const Options& opt) {
+    const int N = opt.N;
+    const int M = opt.M;
+    const int C = opt.C;
+    init_tables(opt);
+    Grid g(N, M);
+    SearchStats stats;
+    const vector<pair<int, int>> cells = get_cell_order(opt.cell_order, N, M);
+    const auto start = chrono::steady_clock::now();
+    if (opt.enumeration == Enumeration::AdjacentSwaps && opt.backend != "boxes") {
+        throw invalid_argument("Adjacent swap enumeration requires --backend=boxes.");
+    }
+    // The fixed engine falls back to backtr on the sizes for which FixedSearch is not compiled.
+    if (opt.memo_log_size > 0 && opt.engine != "backtr" &&
+        (opt.engine != "fixed" || find_fixed(N, M, C) != nullptr)) {
+        throw invalid_argument("The transposition table is only supported by the backtr engine.");
+    }
+    if (opt.memo_log_size > 0 && opt.cell_order != CellOrder::RowMajor &&
+        opt.cell_order != CellOrder::Boustrophedon) {
+        throw invalid_argument("The transposition table requires rows to be completed one at a time.");
+    }
+    if (opt.memo_log_size > 0 && opt.symmetry) {
+        throw invalid_argument("Symmetry breaking cannot be combined with the transposition table.");
+    }
+    if ((opt.forward_check || opt.symmetry) && opt.engine != "backtr" && opt.engine != "stack" &&
+        opt.engine != "parallel" && opt.engine != "pipeline") {
+        throw invalid_argument("Forward checking and symmetry breaking are only supported by the backtr, stack, "
+                               "parallel and pipeline engines.");
+    }
+    if (opt.shards > 0 && opt.engine != "parallel" && opt.engine != "pipeline") {
+        throw invalid_argument("Sharding requires --engine=parallel or --engine=pipeline.");
+    }
+    transpositions.init(opt.memo_log_size);
+    if (opt.engine == "stack") {
+        StackSearch search(opt);
+        search.search(stats);
+    } else if (opt.engine == "parallel" || opt.engine == "pipeline") {
+        ParallelSearch search(opt);
+        search.search(stats);
+    } else if (opt.engine == "separators") {
+        SeparatorSearch search(N, M, C);
+        search.search(0, stats, opt);
+    } else if (opt.engine == "rows") {
+        RowSearch search(opt);
+        search.search(stats);
+    } else if (opt.engine == "mitm") {
+        MeetInTheMiddleSearch search(opt);
+        search.search(stats);
+    } else if (opt.engine == "growth") {
+        GrowthSearch search(opt);
+        search.search(stats);
+    } else if (opt.engine == "candidates") {
+        CandidateSearch search(opt);
+        search.search(stats);
+    } else if (opt.engine == "maps") {
+        TopMapSearch search(opt);
+        search.search(stats);
+    } else if (opt.engine == "tilings" || opt.engine == "min-candidates") {
+        TilingSearch search(opt, opt.engine == "min-candidates");
+        search.search(stats);
+    } else if (opt.engine == "pinwheels") {
+        PinwheelSearch search(opt);
+        search.search(stats);
+    } else if (opt.engine == "fixed") {
+        const FixedRunner run = find_fixed(N, M, C);
+        if (run != nullptr) {
+            run(opt, stats);
+        } else {
+            // Other sizes run the same configuration of the generic backtr.
+            Options generic = opt;
+            generic.enumeration = Enumeration::Extensions;
+            generic.cell_order = CellOrder::RowMajor;
+            PairBoxes v(C);
+            backtr(g, v, stats, generic, get_cell_order(CellOrder::RowMajor, N, M), 0);
+        }
+    } else if (opt.engine != "backtr") {
+        throw invalid_argument("Unknown engine: " + opt.engine);
+    } else if (opt.backend == "naive") {
+        NaiveValidator v(g, C);
+        backtr(g, v, stats, opt, cells, 0);
+    } else if (opt.backend == "boxes") {
+        PairBoxes v(C);
+        backtr(g, v, stats, opt, cells, 0);
+    } else if (opt.backend == "bitboard") {
+        PairBitboards v(N, M, C);
+        backtr(g, v, stats, opt, cells, 0);
+    } else {
+        throw invalid_argument("Unknown backend: " + opt.backend);
+    }
+    return make_pair(stats, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+}
+
+// Compares the node counts of all cell orders on the settings for which Hypothesis 1 is
+// recorded as confirmed in the header, using the backend and enumeration from opt.
+void bench_orders(const Options& opt) {
+    const struct {
+        int N, M, C;
+        bool no_fast_cross;
+    } settings[] = {{8, 8, 4, false}, {4, 5, 5, false}, {3, 6, 5, false}, {3, 3, 6, false}, {6, 6, 6, true}};
+    const pair<CellOrder, string> orders[] = {
+        {CellOrder::RowMajor, "rows"}, {CellOrder::Boustrophedon, "boustrophedon"},
+        {CellOrder::Diagonal, "diagonal"}, {CellOrder::MostConstrained, "constrained"}};
+    cout << "N M C order          nodes       profiles    seconds" << endl;
+    for (const auto& s : settings) {
+        for (const auto& order : orders) {
+            Options o = opt;
+            o.N = s.N;
+            o.M = s.M;
+            o.C = s.C;
+            o.no_fast_cross = o.no_fast_cross || s.no_fast_cross;
+            o.cell_order = order.first;
+            const pair<SearchStats, double> result = run_search(o);
+            cout << s.N << " " << s.M << " " << s.C << " " << left << setw(14) << order.second << " "
+                 << setw(11) << result.first.nodes << " " << setw(11) << result.first.profiles << " "
+                 << result.second << right << endl;
+        }
+    }
+}
+
+// Combines the records of the shards of a search, checking that they describe the same search
+// and together completed each of its tasks exactly once. Prints the counterexample backtr would
+// report if the shards found one, or the statistics of the whole search otherwise. Shards stop
+// at their first counterexample, but only after completing all their tasks before it, so with
+// a counterexample the check only covers the tasks before the first one. The tasks are cut
+// again from the search key, so that the claims of every shard about the tasks it completed
+// are checked against their digests. Returns the exit code.
+int merge_shards(const vector<string>& files) {
+    vector<ShardRecord> records;
+    for (const string& file : files) {
+        records.push_back(ShardRecord::read(file));
+    }
+    const ShardRecord& first = records[0];
+    vector<bool> seen(first.shards);
+    for (size_t i = 0; i < records.size(); ++i) {
+        const ShardRecord& x = records[i];
+        if (x.key != first.key || x.shards != first.shards || x.prefix_depth != first.prefix_depth ||
+            x.num_tasks != first.num_tasks || x.tasks_digest != first.tasks_digest) {
+            throw invalid_argument(files[i] + " belongs to a different search than " + files[0] + ".");
+        }
+        if (x.shard < 0 || x.shard >= x.shards || seen[x.shard]) {
+            throw invalid_argument("Shard " + to_string(x.shard) + " of " + files[i] + " is repeated or invalid.");
+        }
+        seen[x.shard] = true;
+    }
+    if (static_cast<int>(records.size()) != first.shards) {
+        throw invalid_argument("Expected the records of all " + to_string(first.shards) + " shards.");
+    }
+    Options opt = search_options(first.key);
+    opt.engine = "parallel";
+    opt.prefix_depth = first.prefix_depth;
+    opt.threads = 1;
+    init_tables(opt);
+    ParallelSearch search(opt);
+    search.make_tasks();
+    uint64_t tasks_digest = 0;
+    for (long long t = 0; t < search.num_tasks; ++t) {
+        tasks_digest += search.task_hash(t);
+    }
+    if (search.num_tasks != first.num_tasks || tasks_digest != first.tasks_digest) {
+        throw invalid_argument("The tasks of the shard records do not match the search they describe.");
+    }
+    const ShardRecord* found = nullptr;
+    for (const ShardRecord& x : records) {
+        if (x.counterexample_task != -1 && (found == nullptr || x.counterexample_task < found->counterexample_task)) {
+            found = &x;
+        }
+    }
+    // Every task before the first counterexample (all tasks if there is none) must be complete.
+    const long long needed = found != nullptr ? found->counterexample_task : first.num_tasks;
+    for (const ShardRecord& x : records) {
+        uint64_t digest = 0;
+        for (long long t = x.shard; t < min(x.complete_below, first.num_tasks); t += x.shards) {
+            digest += search.task_hash(t);
+        }
+        if (x.complete_below < needed || digest != x.complete_below_digest) {
+            throw invalid_argument("Shard " + to_string(x.shard) + " did not complete all its tasks before task " +
+                                   to_string(needed) + ".");
+        }
+    }
+    if (found != nullptr) {
+        cerr << "Shard " << found->shard << " found the first counterexample, in task "
+             << found->counterexample_task << "." << endl;
+        show(found->counterexample, opt.C);
+        return 1;
+    }
+    SearchStats stats;
+    long long completed = 0;
+    uint64_t completed_digest = 0;
+    double seconds = 0, longest = 0;
+    for (const ShardRecord& x : records) {
+        stats += x.stats;
+        completed += x.completed;
+        completed_digest += x.completed_digest;
+        seconds += x.seconds;
+        longest = max(longest, x.seconds);
+    }
+    if (completed != first.num_tasks || completed_digest != first.tasks_digest) {
+        throw invalid_argument("The shards completed " + to_string(completed) + " tasks, which do not cover the " +
+                          to_string(first.num_tasks) + " tasks of the search exactly once.");
+    }
+    cerr << "Merged " << first.shards << " shards covering all " << first.num_tasks << " tasks: explored "
+         << stats.nodes << " nodes in " << seconds << "s (longest shard " << longest << "s), found "
+         << stats.profiles << " grid profiles (digest " << hex << stats.digest << dec << ")";
+    if (stats.wipeouts > 0) {
+        cerr << ", forward checking wiped out " << stats.wipeouts << " placements";
+    }
+    if (stats.canonical > 0) {
+        cerr << ", " << stats.canonical << " of them canonical";
+    }
+    cerr << "." << endl;
+    return 0;
+}
+
+// Runs the command given by opt, returning the exit code.
+int run_command(const Options& opt) {
+    if (opt.bench_orders) {
+        bench_orders(opt);
+        return 0;
+    }
+    if (!opt.merge_files.empty()) {
+        return merge_shards(opt.merge_files);
+    }
+    const pair<SearchStats, double> result = run_search(opt);
+    const SearchStats& stats = result.first;
+    const double seconds = result.second;
+    cerr << "Explored " << stats.nodes << " nodes in " << seconds << "s ("
+         << static_cast<long long>(stats.nodes / max(seconds, 1e-9)) << " nodes/sec), found "
+         << stats.profiles << " grid profiles (digest " << hex << stats.digest << dec << ")";
+    if (opt.forward_check) {
+        cerr << ", forward checking wiped out " << stats.wipeouts << " placements";
+    }
+    if (opt.memo_log_size > 0) {
+        cerr << ", skipped " << stats.memo_hits << " subtrees (digest only covers the others)";
+    }
+    if (opt.symmetry) {
+        cerr << ", " << stats.canonical << " of them canonical";
+    }
+    if (opt.engine == "growth") {
+        cerr << ", the digest is not computed by this engine";
+    }
+    cerr << "." << endl;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    try {
+        return run_command(parse_options(argc, argv));
+    } catch (const invalid_argument& e) {
+        cerr << e.what() << endl << Usage;
+        return 2;
+    } catch (const runtime_error& e) {
+        cerr << e.what() << endl;
+        return 2;
+    }
 }